@@ -0,0 +1,176 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    main.cpp
+ * @brief   Contention stress test of std::mutex, std::timed_mutex, std::shared_mutex and std::call_once
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ *
+ * Several std::threads of different priorities hammer the same locks and once flags. The counters protected by the
+ * locks are updated with a task switch between reading and writing, so a lock that lets two tasks in loses counts. A
+ * lost wakeup leaves a task blocked forever, the test then fails after its timeout. Prints "PASSED" and exits with 0,
+ * or prints what failed and exits with 1. Run it with configNUMBER_OF_CORES > 1 as well.
+ */
+
+#include "arduino_freertos.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unistd.h>
+#if configUSE_POSIX_PROFILER == 1
+#include "portable/utils/profiler.h"
+#endif
+
+
+namespace {
+constexpr unsigned TASKS_PER_PRIORITY { 3 };
+constexpr unsigned PRIORITIES { 3 };
+constexpr unsigned TASKS { TASKS_PER_PRIORITY * PRIORITIES };
+constexpr unsigned ROUNDS { 2'000 };
+constexpr TickType_t TIMEOUT { pdMS_TO_TICKS(120'000) };
+
+std::mutex g_mutex;
+unsigned g_mutex_count {};
+
+std::timed_mutex g_timed_mutex;
+unsigned g_timed_count {};
+std::atomic<unsigned> g_timeouts {};
+
+std::shared_mutex g_shared_mutex;
+unsigned g_writer_a {};
+unsigned g_writer_b {};
+unsigned g_shared_writes {};
+std::atomic<unsigned> g_torn_reads {};
+
+std::once_flag g_once[ROUNDS];
+std::atomic<unsigned> g_once_calls[ROUNDS] {};
+
+std::atomic<unsigned> g_finished {};
+
+// read, switch to another task, write back
+void increment(unsigned& counter) {
+    const auto value { counter };
+    ::taskYIELD();
+    counter = value + 1;
+}
+
+void worker(unsigned id) {
+    using namespace std::chrono_literals;
+
+    for (unsigned round {}; round < ROUNDS; ++round) {
+        {
+            std::lock_guard lock { g_mutex };
+            increment(g_mutex_count);
+        }
+
+        if (g_timed_mutex.try_lock_for(1ms)) {
+            increment(g_timed_count);
+            std::this_thread::sleep_for(1ms); // let other waiters time out
+            g_timed_mutex.unlock();
+        } else {
+            ++g_timeouts;
+        }
+
+        if ((round + id) % 4 == 0) {
+            std::unique_lock lock { g_shared_mutex };
+            ++g_writer_a;
+            ::taskYIELD();
+            ++g_writer_b;
+            ++g_shared_writes;
+        } else {
+            std::shared_lock lock { g_shared_mutex };
+            const auto a { g_writer_a };
+            ::taskYIELD();
+            if (a != g_writer_b) {
+                ++g_torn_reads;
+            }
+        }
+
+        // all tasks reach the flag of a round about the same time, the function blocks so that the others queue up
+        std::call_once(g_once[round], [round]() {
+            ++g_once_calls[round];
+            ::vTaskDelay(1);
+        });
+    }
+
+    ++g_finished;
+}
+
+void check(const char* what, unsigned value, unsigned expected, bool& passed) {
+    if (value != expected) {
+        ::printf("%s: %u, expected %u\r\n", what, value, expected);
+        passed = false;
+    }
+}
+
+// the workers may still run, so static destructors and atexit() handlers are skipped, the profile is written here
+[[noreturn]] void finish(int status) {
+    ::fflush(stdout);
+#if configUSE_POSIX_PROFILER == 1
+    ::vProfilerFlush();
+#endif
+    ::_exit(status);
+}
+
+void supervisor(void*) {
+    std::thread threads[TASKS];
+    for (unsigned i {}; i < TASKS; ++i) {
+        threads[i] = free_rtos_std::make_thread({ .name = "worker", .priority = 2 + i % PRIORITIES }, worker, i);
+    }
+
+    const auto start { ::xTaskGetTickCount() };
+    while (g_finished < TASKS) {
+        if (::xTaskGetTickCount() - start > TIMEOUT) {
+            ::printf("FAILED: %u of %u tasks finished, the others are blocked\r\n", g_finished.load(), TASKS);
+            freertos::print_all_stack_traces();
+            finish(1);
+        }
+        ::vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    bool passed { true };
+    check("std::mutex count", g_mutex_count, TASKS * ROUNDS, passed);
+    check("std::timed_mutex count + timeouts", g_timed_count + g_timeouts, TASKS * ROUNDS, passed);
+    check("std::shared_mutex writer a", g_writer_a, g_shared_writes, passed);
+    check("std::shared_mutex writer b", g_writer_b, g_shared_writes, passed);
+    check("std::shared_mutex torn reads", g_torn_reads, 0, passed);
+    for (unsigned i {}; i < ROUNDS; ++i) {
+        check("std::call_once calls", g_once_calls[i], 1, passed);
+    }
+
+    ::printf("%s: %u timeouts of std::timed_mutex, %u writes of std::shared_mutex\r\n", passed ? "PASSED" : "FAILED",
+        g_timeouts.load(), g_shared_writes);
+    finish(passed ? 0 : 1);
+}
+} // namespace
+
+int main() {
+    ::xTaskCreate(supervisor, "supervisor", 1024, nullptr, configMAX_PRIORITIES - 1, nullptr);
+
+    ::puts("main(): starting scheduler...");
+
+    ::vTaskStartScheduler();
+}
@@ -47,9 +47,7 @@ static void task1(void*) {
 
 static void task2(void*) {
 #ifdef __cpp_lib_jthread
-    g_t1 = new std::jthread { [](std::stop_token stop) {
-        ::vTaskPrioritySet(nullptr, 3);
-
+    g_t1 = new std::jthread { free_rtos_std::make_thread<std::jthread>({ .name = "t1", .priority = 3 }, [](std::stop_token stop) {
         while (!stop.stop_requested()) {
             using namespace std::chrono_literals;
 
@@ -60,12 +58,10 @@ static void task2(void*) {
             std::this_thread::sleep_for(500ms);
         }
         ::puts("Thread stopped.");
-    } };
+    }) };
     configASSERT(g_t1);
 #else // ! __cpp_lib_jthread
-    std::thread t1 { []() {
-        ::vTaskPrioritySet(nullptr, 3);
-
+    auto t1 { free_rtos_std::make_thread({ .name = "t1", .priority = 3 }, []() {
         while (true) {
             using namespace std::chrono_literals;
 
@@ -75,7 +71,7 @@ static void task2(void*) {
             ::printf("TOCK 2\tnow: %lu s\r\n", freertos::get_us() / 1'000'000UL);
             std::this_thread::sleep_for(500ms);
         }
-    } };
+    }) };
 #endif // __cpp_lib_jthread
 
     ::vTaskSuspend(nullptr);
@@ -53,9 +53,11 @@
 
 #include "thread_gthread.h"
 #include "condition_variable.h"
+#include "gthr_rwlock.h"
 #include "gthr_key.h"
+#include "gthr_time.h"
 
-#include <sys/time.h>
+#include <cerrno>
 
 
 typedef free_rtos_std::gthr_freertos __gthread_t;
@@ -63,30 +65,38 @@ typedef free_rtos_std::gthr_freertos __gthread_t;
 extern "C" {
 
 #define _GLIBCXX_HAS_GTHREADS 1
-#define _GLIBCXX_USE_PTHREAD_RWLOCK_T 0
+#undef _GLIBCXX_USE_PTHREAD_RWLOCK_T
+#define _GLIBCXX_USE_PTHREAD_RWLOCK_T 1
+#undef _GLIBCXX_USE_PTHREAD_RWLOCK_CLOCKLOCK
+#define _GLIBCXX_USE_PTHREAD_RWLOCK_CLOCKLOCK 1
 #define _GLIBCXX_USE_SCHED_YIELD
 #undef _GLIBCXX_USE_PTHREAD_MUTEX_CLOCKLOCK
+#define _GLIBCXX_USE_PTHREAD_MUTEX_CLOCKLOCK 1
 #undef _GLIBCXX_USE_PTHREAD_COND_CLOCKWAIT
+#define _GLIBCXX_USE_PTHREAD_COND_CLOCKWAIT 1
 #undef _GLIBCXX_NATIVE_THREAD_ID
 #define __GTHREADS 1
 #define __GTHREADS_CXX0X 1
 #define __GTHREAD_ONCE_INIT 0
 #define __GTHREAD_COND_INIT {}
+#define __GTHREAD_MUTEX_INIT {}
+#define __GTHREAD_RECURSIVE_MUTEX_INIT {}
 #define _GTHREAD_USE_MUTEX_TIMEDLOCK 1
 
+// <shared_mutex> calls the pthread_rwlock functions through these wrappers, they are routed to free_rtos_std::gthr_rwlock
+#define __gthrw(name)
+#define __gthrw_(name) free_rtos_std::name
+
 typedef free_rtos_std::Key* __gthread_key_t;
 typedef int __gthread_once_t;
-typedef SemaphoreHandle_t __gthread_mutex_t;
-typedef SemaphoreHandle_t __gthread_recursive_mutex_t;
+typedef free_rtos_std::gthr_mutex __gthread_mutex_t;
+typedef free_rtos_std::gthr_recursive_mutex __gthread_recursive_mutex_t;
 typedef free_rtos_std::cv_task_list __gthread_cond_t;
 
 
-static inline void __GTHREAD_RECURSIVE_MUTEX_INIT_FUNCTION(__gthread_recursive_mutex_t* mutex) {
-    *mutex = ::xSemaphoreCreateRecursiveMutex();
-}
-static inline void __GTHREAD_MUTEX_INIT_FUNCTION(__gthread_mutex_t* mutex) {
-    *mutex = ::xSemaphoreCreateMutex();
-}
+// the mutexes are constant initialised by __GTHREAD_MUTEX_INIT and __GTHREAD_RECURSIVE_MUTEX_INIT, nothing to create
+static inline void __GTHREAD_RECURSIVE_MUTEX_INIT_FUNCTION(__gthread_recursive_mutex_t*) {}
+static inline void __GTHREAD_MUTEX_INIT_FUNCTION(__gthread_mutex_t*) {}
 
 int __gthread_active_p();
 int __gthread_once(__gthread_once_t*, void (*)(void));
@@ -108,78 +118,47 @@ static inline int __gthread_setspecific(__gthread_key_t key, const void* ptr) {
 }
 
 
-static inline int __gthread_mutex_destroy(__gthread_mutex_t* mutex) {
-    ::vSemaphoreDelete(*mutex);
+static inline int __gthread_mutex_destroy(__gthread_mutex_t*) {
     return 0;
 }
-static inline int __gthread_recursive_mutex_destroy(__gthread_recursive_mutex_t* mutex) {
-    ::vSemaphoreDelete(*mutex);
+static inline int __gthread_recursive_mutex_destroy(__gthread_recursive_mutex_t*) {
     return 0;
 }
 
 static inline int __gthread_mutex_lock(__gthread_mutex_t* mutex) {
-    return (::xSemaphoreTake(*mutex, portMAX_DELAY) == pdTRUE) ? 0 : 1;
+    return mutex->lock(portMAX_DELAY) ? 0 : 1;
 }
 static inline int __gthread_mutex_trylock(__gthread_mutex_t* mutex) {
-    return (::xSemaphoreTake(*mutex, 0) == pdTRUE) ? 0 : 1;
+    return mutex->try_lock() ? 0 : 1;
 }
 static inline int __gthread_mutex_unlock(__gthread_mutex_t* mutex) {
-    return (::xSemaphoreGive(*mutex) == pdTRUE) ? 0 : 1;
+    mutex->unlock();
+    return 0;
 }
 
 static inline int __gthread_recursive_mutex_lock(__gthread_recursive_mutex_t* mutex) {
-    return (::xSemaphoreTakeRecursive(*mutex, portMAX_DELAY) == pdTRUE) ? 0 : 1;
+    return mutex->lock(portMAX_DELAY) ? 0 : 1;
 }
 static inline int __gthread_recursive_mutex_trylock(__gthread_recursive_mutex_t* mutex) {
-    return (::xSemaphoreTakeRecursive(*mutex, 0) == pdTRUE) ? 0 : 1;
+    return mutex->try_lock() ? 0 : 1;
 }
 static inline int __gthread_recursive_mutex_unlock(__gthread_recursive_mutex_t* mutex) {
-    return (::xSemaphoreGiveRecursive(*mutex) == pdTRUE) ? 0 : 1;
+    mutex->unlock();
+    return 0;
 }
 
 
-struct __gthread_time_t {
-    long sec;
-    long nsec;
-    int64_t milliseconds() const {
-        return static_cast<int64_t>(sec) * 1'000 + (nsec + 500'000) / 1'000'000;
-    }
-};
-
-static inline __gthread_time_t operator-(const __gthread_time_t& lhs, const timeval& rhs) {
-    long s { lhs.sec - rhs.tv_sec };
-    int64_t ns { lhs.nsec - rhs.tv_usec * 1'000 };
-    if (ns < 0) {
-        --s;
-        ns += 1'000'000'000;
-    } else if (ns > 1'000'000'000) {
-        ++s;
-        ns -= 1'000'000'000;
-    }
-
-    return __gthread_time_t { s, static_cast<long>(ns) };
-}
+// A timespec, <shared_mutex> passes it to the pthread_rwlock functions. Being a type of its own, the pthread_rwlock_clock
+// overloads below are preferred to the ones of the C library.
+struct __gthread_time_t : timespec {};
 
+// the absolute timeouts of the __gthread functions are on the system clock, see gthr_time.h
 static inline int __gthread_mutex_timedlock(__gthread_mutex_t* m, const __gthread_time_t* abs_timeout) {
-    timeval now {};
-    gettimeofday(&now, NULL);
-
-    auto t { static_cast<int32_t>((*abs_timeout - now).milliseconds()) };
-    if (t < 0) {
-        t = 0;
-    }
-    return (::xSemaphoreTake(*m, pdMS_TO_TICKS(t)) == pdTRUE) ? 0 : 1;
+    return free_rtos_std::lock_until(CLOCK_REALTIME, *abs_timeout, [m](TickType_t ticks) { return m->lock(ticks); }) ? 0 : ETIMEDOUT;
 }
 
 static inline int __gthread_recursive_mutex_timedlock(__gthread_recursive_mutex_t* m, const __gthread_time_t* abs_timeout) {
-    timeval now {};
-    gettimeofday(&now, NULL);
-
-    auto t { static_cast<int32_t>((*abs_timeout - now).milliseconds()) };
-    if (t < 0) {
-        t = 0;
-    }
-    return (::xSemaphoreTakeRecursive(*m, pdMS_TO_TICKS(t)) == pdTRUE) ? 0 : 1;
+    return free_rtos_std::lock_until(CLOCK_REALTIME, *abs_timeout, [m](TickType_t ticks) { return m->lock(ticks); }) ? 0 : ETIMEDOUT;
 }
 
 // All functions returning int should return zero on success or the error number.  If the operation is not supported, -1 is returned.
@@ -220,6 +199,26 @@ static inline int __gthread_cond_destroy(__gthread_cond_t*) {
 }
 
 } // extern "C"
+
+// Waits on another clock than the system clock, e.g. for std::chrono::steady_clock. <mutex>, <condition_variable> and
+// <shared_mutex> call these pthread functions directly, they are overloaded for the gthread types here.
+static inline int pthread_mutex_clocklock(__gthread_mutex_t* m, clockid_t clock, const __gthread_time_t* abs_timeout) {
+    return free_rtos_std::lock_until(clock, *abs_timeout, [m](TickType_t ticks) { return m->lock(ticks); }) ? 0 : ETIMEDOUT;
+}
+
+static inline int pthread_mutex_clocklock(__gthread_recursive_mutex_t* m, clockid_t clock, const __gthread_time_t* abs_timeout) {
+    return free_rtos_std::lock_until(clock, *abs_timeout, [m](TickType_t ticks) { return m->lock(ticks); }) ? 0 : ETIMEDOUT;
+}
+
+int pthread_cond_clockwait(__gthread_cond_t*, __gthread_mutex_t*, clockid_t, const __gthread_time_t*);
+
+static inline int pthread_rwlock_clockrdlock(pthread_rwlock_t* rwlock, clockid_t clock, const __gthread_time_t* abs_timeout) {
+    return free_rtos_std::pthread_rwlock_clockrdlock(rwlock, clock, abs_timeout);
+}
+
+static inline int pthread_rwlock_clockwrlock(pthread_rwlock_t* rwlock, clockid_t clock, const __gthread_time_t* abs_timeout) {
+    return free_rtos_std::pthread_rwlock_clockwrlock(rwlock, clock, abs_timeout);
+}
 #else
 #warning "Compiler too old for std::thread support with FreeRTOS."
 #undef _GLIBCXX_HAS_GTHREADS
@@ -52,15 +52,7 @@ condition_variable::~condition_variable() { // It is only safe to invoke the des
 }
 
 void condition_variable::wait(std::unique_lock<std::mutex>& m) { // pre-condition: m is taken!!
-    _M_cond.lock();
-    _M_cond.push(__gthread_t::native_task_handle());
-    _M_cond.unlock();
-
-    m.unlock();
-
-    ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, portMAX_DELAY);
-
-    m.lock();
+    __gthread_cond_wait(&_M_cond, m.mutex()->native_handle());
 }
 
 void condition_variable::notify_one() {
@@ -74,13 +66,7 @@ void condition_variable::notify_one() {
 }
 
 void condition_variable::notify_all() {
-    _M_cond.lock();
-    while (!_M_cond.empty()) {
-        auto t = _M_cond.front();
-        _M_cond.pop();
-        ::xTaskNotifyGiveIndexed(t, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
-    }
-    _M_cond.unlock();
+    __gthread_cond_broadcast(&_M_cond);
 }
 
 } // namespace std
@@ -40,8 +40,7 @@
 #include "portable/posix.h"
 #include "semphr.h"
 #include "thread_gthread.h"
-
-#include <list>
+#include "gthr_mutex.h"
 
 
 namespace free_rtos_std {
@@ -79,50 +78,42 @@ private:
 // Internal free rtos task's container to support condition variable.
 // Condition variable must know all the threads waiting in a queue.
 //
-class cv_task_list {
+class cv_task_list : public task_fifo {
 public:
-    using __gthread_t = free_rtos_std::gthr_freertos;
-    using thrd_type = __gthread_t::native_task_type;
-    using queue_type = std::list<thrd_type>;
-
     cv_task_list() = default;
 
-    void remove(thrd_type thrd) {
-        _que.remove(thrd);
-    }
-    void push(thrd_type thrd) {
-        _que.push_back(thrd);
-    }
-    void pop() {
-        _que.pop_front();
-    }
-    bool empty() const {
-        return _que.empty();
-    }
-
     ~cv_task_list() {
         lock();
-        _que = queue_type {};
+        _head = _tail = nullptr;
         unlock();
     }
 
-    // no copy and no move
-    cv_task_list& operator=(const cv_task_list& r) = delete;
-    cv_task_list& operator=(cv_task_list&& r) = delete;
-    cv_task_list(cv_task_list&&) = delete;
-    cv_task_list(const cv_task_list&) = delete;
-
-    thrd_type& front() {
-        return _que.front();
-    }
-    const thrd_type& front() const {
-        return _que.front();
+    void push(node& n, gthr_mutex* mutex) {
+        task_fifo::push(n);
+        _mutex = mutex;
     }
-    thrd_type& back() {
-        return _que.back();
+
+    // moves all waiters to the wait list of their mutex, wakes the first one if the mutex is free
+    void morph() {
+        if (empty()) {
+            return;
+        }
+#if configNUMBER_OF_CORES > 1
+        // with more than one core the one by one handoff keeps the other cores idle, so wake them all
+        while (!empty()) {
+            const auto task { front() };
+            pop();
+            ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+        }
+#else
+        _mutex->morph(*this);
+#endif
     }
-    const thrd_type& back() const {
-        return _que.back();
+
+    // takes a waiter that timed out off the condition variable or the mutex, false if it was notified already
+    bool remove(node& n) {
+        critical_section critical;
+        return task_fifo::remove(n) || (_mutex && _mutex->remove(n));
     }
 
     void lock() {
@@ -133,7 +124,7 @@ public:
     }
 
 private:
-    queue_type _que;
+    gthr_mutex* _mutex {}; // the mutex of the current waiters
     semaphore _sem;
 };
 } // namespace free_rtos_std
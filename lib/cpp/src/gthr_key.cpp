@@ -36,53 +36,137 @@
 
 #if (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) >= 60100
 #include "gthr_key_type.h"
+#include "gthr_mutex.h"
+
+#include <cerrno>
+#include <climits>
 
 
 namespace free_rtos_std {
 
-Key* s_key;
+static Key s_keys[configPOSIX_GTHREAD_KEYS];
+static Key::Values s_main_values; // used by main() and by host threads that aren't tasks
+
+static size_t index(const Key* key) {
+    return static_cast<size_t>(key - s_keys);
+}
+
+// the calling task, nullptr for main() and for host threads. Not current_task(), it caches the handle per host thread
+// with SMP and would pin the task that ran when a host thread asked first.
+static TaskHandle_t own_task() {
+    if (::xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED || !::xPortIsTaskThread()) {
+        return nullptr;
+    }
+    return ::xTaskGetCurrentTaskHandle();
+}
+
+static Key::Values* values(bool create) {
+    const auto task { own_task() };
+    if (!task) {
+        return &s_main_values;
+    }
+
+    auto p_values { static_cast<Key::Values*>(::pvTaskGetThreadLocalStoragePointer(task, Key::TLS_INDEX)) };
+    if (!p_values && create) {
+        // from the kernel heap like the control block of a std::thread, the host malloc() must not be interrupted by a
+        // task switch
+        p_values = static_cast<Key::Values*>(::pvPortMalloc(sizeof(Key::Values)));
+        if (p_values) {
+            *p_values = {};
+            ::vTaskSetThreadLocalStoragePointer(task, Key::TLS_INDEX, p_values);
+        }
+    }
+    return p_values;
+}
 
 int freertos_gthread_key_create(Key** keyp, void (*dtor)(void*)) {
-    // There is only one key for all threads. If more keys are needed
-    // a list must be implemented.
-    configASSERT(!s_key);
-    s_key = new Key(dtor);
+    for (auto& key : s_keys) {
+        bool used {};
+        if (__atomic_compare_exchange_n(&key._used, &used, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            key._desFoo = dtor;
+            if (!__atomic_add_fetch(&key._gen, 1, __ATOMIC_RELEASE)) {
+                __atomic_store_n(&key._gen, 1, __ATOMIC_RELEASE); // wrapped around
+            }
 
-    *keyp = s_key;
-    return 0;
+            *keyp = &key;
+            return 0;
+        }
+    }
+    return 11; // POSIX error: EAGAIN
 }
 
-int freertos_gthread_key_delete(Key*) {
+int freertos_gthread_key_delete(Key* key) {
     // no synchronization here:
     //   It is up to the applicaiton to delete (or maintain a reference)
     //   the thread specific data associated with the key.
-    delete s_key;
-    s_key = nullptr;
+    __atomic_store_n(&key->_used, false, __ATOMIC_RELEASE);
     return 0;
 }
 
 void* freertos_gthread_getspecific(Key* key) {
-    std::lock_guard<std::mutex> lg { key->_mtx };
-
-    auto item = key->_specValue.find(__gthread_t::self().native_task_handle());
-    if (item == key->_specValue.end()) {
+    const auto p_values { values(false) };
+    if (!p_values) {
         return nullptr;
     }
-    return const_cast<void*>(item->second);
+
+    const auto& value { p_values->values[index(key)] };
+    return value.gen == __atomic_load_n(&key->_gen, __ATOMIC_RELAXED) ? const_cast<void*>(value.ptr) : nullptr;
 }
 
 int freertos_gthread_setspecific(Key* key, const void* ptr) {
-    std::lock_guard<std::mutex> lg { key->_mtx };
-
-    auto& cont { key->_specValue };
-    auto task { __gthread_t::self().native_task_handle() };
-    if (ptr) {
-        cont[task] = ptr;
-    } else {
-        (void) cont.erase(task);
+    const auto p_values { values(ptr) };
+    if (!p_values) {
+        return ptr ? ENOMEM : 0; // a nullptr needs no block, nothing set yet reads as nullptr
     }
+
+    p_values->values[index(key)] = { ptr, __atomic_load_n(&key->_gen, __ATOMIC_RELAXED) };
     return 0;
 }
 
+void freertos_gthread_key_destruct() {
+    const auto p_values { values(false) };
+    if (!p_values) {
+        return;
+    }
+
+    // a destructor may set values again, like POSIX try it PTHREAD_DESTRUCTOR_ITERATIONS times
+    for (uint8_t i {}; i < PTHREAD_DESTRUCTOR_ITERATIONS; ++i) {
+        bool called {};
+        for (auto& key : s_keys) {
+            auto& value { p_values->values[index(&key)] };
+            const auto ptr { const_cast<void*>(value.ptr) };
+            if (!ptr || !__atomic_load_n(&key._used, __ATOMIC_ACQUIRE) || value.gen != __atomic_load_n(&key._gen, __ATOMIC_RELAXED)) {
+                continue;
+            }
+
+            value.ptr = nullptr;
+            if (key._desFoo) {
+                key._desFoo(ptr);
+                called = true;
+            }
+        }
+        if (!called) {
+            break;
+        }
+    }
+
+    if (p_values != &s_main_values) {
+        ::vTaskSetThreadLocalStoragePointer(own_task(), Key::TLS_INDEX, nullptr);
+        ::vPortFree(p_values);
+    }
+}
+
 } // namespace free_rtos_std
+
+// Called by the port when a deleted task is cleaned up. A task that isn't a std::thread and ends with vTaskDelete() never
+// called freertos_gthread_key_destruct(), its values are freed without running the destructors like for a cancelled
+// pthread.
+extern "C" void vPortFreeTaskKeys(void* task) {
+    const auto handle { static_cast<TaskHandle_t>(task) };
+    const auto p_values { ::pvTaskGetThreadLocalStoragePointer(handle, free_rtos_std::Key::TLS_INDEX) };
+    if (p_values) {
+        ::vTaskSetThreadLocalStoragePointer(handle, free_rtos_std::Key::TLS_INDEX, nullptr);
+        ::vPortFree(p_values);
+    }
+}
 #endif // GCC VERSION >= 60100
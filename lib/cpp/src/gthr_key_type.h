@@ -35,43 +35,45 @@
 
 #pragma once
 
-#include "thread_gthread.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
-#include <unordered_map>
-#include <mutex>
+#include <cstdint>
 
-namespace free_rtos_std {
 
-struct Key {
-    using __gthread_t = free_rtos_std::gthr_freertos;
-    typedef void (*DestructorFoo)(void*);
+#ifndef configPOSIX_GTHREAD_KEYS
+#define configPOSIX_GTHREAD_KEYS 16
+#endif
 
-    Key() = delete;
-    explicit Key(DestructorFoo des) : _desFoo { des } {}
+static_assert(configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0, "the gthread keys require a thread local storage pointer");
 
-    void CallDestructor(__gthread_t::native_task_type task) {
-        void* val;
+namespace free_rtos_std {
 
-        {
-            std::lock_guard<std::mutex> lg { _mtx };
+// Keys are entries of a static table. The values of a task are kept in a
+// block of its own that the last thread local storage pointer of the task
+// points to, so looking a value up takes no lock. A value is tagged with the
+// generation of its key, a deleted and created again key reads as nullptr.
+//
+struct Key {
+    typedef void (*DestructorFoo)(void*);
 
-            auto item { _specValue.find(task) };
-            if (item == _specValue.end()) {
-                return;
-            }
+    static constexpr BaseType_t TLS_INDEX { configNUM_THREAD_LOCAL_STORAGE_POINTERS - 1 };
 
-            val = const_cast<void*>(item->second);
-            _specValue.erase(item);
-        }
+    struct Value {
+        const void* ptr;
+        uint32_t gen;
+    };
 
-        if (_desFoo && val) {
-            _desFoo(val);
-        }
-    }
+    struct Values {
+        Value values[configPOSIX_GTHREAD_KEYS];
+    };
 
-    std::mutex _mtx;
     DestructorFoo _desFoo;
-    std::unordered_map<__gthread_t::native_task_type, const void*> _specValue;
+    uint32_t _gen; // incremented when the key is created, 0 is never used
+    bool _used;
 };
 
+// runs the destructors of the values of the calling task and frees its values
+void freertos_gthread_key_destruct();
+
 } // namespace free_rtos_std
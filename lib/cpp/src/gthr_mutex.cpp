@@ -0,0 +1,156 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    gthr_mutex.cpp
+ * @brief   Contended paths of the mutex behind std::mutex
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ */
+
+#if (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) >= 60100
+#include "gthr_mutex.h"
+
+
+namespace free_rtos_std {
+
+// Called in a critical section. Takes the mutex if it is free, flagging it again if there are more waiters,
+// otherwise flags the owner word so that the owner wakes a waiter when unlocking. A flagged owner is counted once
+// with add_held(), unlocking drops the count again in wake().
+bool gthr_mutex::acquire_or_flag(uintptr_t task) {
+    auto owner { __atomic_load_n(&_owner, __ATOMIC_RELAXED) };
+    while (true) {
+        if (!owner) {
+            const auto next { task | (_waiters.empty() ? 0 : CONTENDED) };
+            if (__atomic_compare_exchange_n(&_owner, &owner, next, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                if (next & CONTENDED) {
+                    add_held(task);
+                }
+                return true;
+            }
+        } else if (owner & CONTENDED) {
+#if configUSE_MUTEXES == 1
+            ::xTaskPriorityInherit(reinterpret_cast<TaskHandle_t>(owner & ~CONTENDED));
+#endif
+            return false;
+        } else if (__atomic_compare_exchange_n(&_owner, &owner, owner | CONTENDED, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            add_held(owner);
+#if configUSE_MUTEXES == 1
+            ::xTaskPriorityInherit(reinterpret_cast<TaskHandle_t>(owner));
+#endif
+            return false;
+        }
+    }
+}
+
+bool gthr_mutex::lock_contended(TickType_t ticks) {
+    const auto task { self() };
+    task_fifo::node waiter { reinterpret_cast<TaskHandle_t>(task) };
+    TimeOut_t timeout;
+    ::vTaskSetTimeOutState(&timeout);
+
+    while (true) {
+        {
+            critical_section critical;
+            if (acquire_or_flag(task)) {
+                return true;
+            }
+            _waiters.insert(waiter);
+        }
+
+        if (!::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, ticks)) {
+            critical_section critical;
+            if (_waiters.remove(waiter)) {
+                timed_out();
+                return false;
+            }
+            // woken meanwhile, the notification was given when the waiter was taken off the list
+            ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, 0);
+        }
+
+        if (::xTaskCheckForTimeOut(&timeout, &ticks)) {
+            // a woken waiter must try once more, it flags the mutex for the remaining waiters
+            critical_section critical;
+            if (acquire_or_flag(task)) {
+                return true;
+            }
+            timed_out();
+            return false;
+        }
+    }
+}
+
+// Called in a critical section after a waiter gave up. Like queue.c, the owner keeps the priority of the remaining
+// waiters only, the owner word stays flagged.
+void gthr_mutex::timed_out() {
+    const auto owner { __atomic_load_n(&_owner, __ATOMIC_RELAXED) };
+    if ((owner & CONTENDED) && (owner & ~CONTENDED)) {
+        disinherit_after_timeout(owner & ~CONTENDED, _waiters.top_priority());
+    }
+}
+
+void gthr_mutex::relock() {
+    if (!try_lock()) {
+        lock_contended(portMAX_DELAY);
+    } else if (!_waiters.empty()) {
+        // woken from the wait list while the mutex was free, the others are woken when it is unlocked
+        critical_section critical;
+        if (!_waiters.empty() && !(__atomic_fetch_or(&_owner, CONTENDED, __ATOMIC_RELAXED) & CONTENDED)) {
+            add_held(self());
+        }
+    }
+}
+
+void gthr_mutex::morph(task_fifo& waiters) {
+    critical_section critical;
+    _waiters.merge(waiters);
+
+    auto owner { __atomic_load_n(&_owner, __ATOMIC_RELAXED) };
+    while (owner && !(owner & CONTENDED)) {
+        if (__atomic_compare_exchange_n(&_owner, &owner, owner | CONTENDED, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            add_held(owner);
+            return;
+        }
+    }
+    if (!owner && !_waiters.empty()) {
+        const auto task { _waiters.front() };
+        _waiters.pop(); // before the notification, it may switch to the task
+        ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+    }
+}
+
+void gthr_mutex::wake() {
+    BaseType_t yield {};
+    {
+        critical_section critical;
+        if (!_waiters.empty()) {
+            const auto task { _waiters.front() };
+            _waiters.pop();
+            ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+        }
+        // the priority stays up if the task holds other FreeRTOS mutexes or flagged locks
+        yield = release_held();
+    }
+
+    if (yield) {
+        taskYIELD();
+    }
+}
+
+} // namespace free_rtos_std
+#endif // GCC VERSION >= 60100
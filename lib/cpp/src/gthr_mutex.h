@@ -0,0 +1,265 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    gthr_mutex.h
+ * @brief   Mutex behind std::mutex, blocks in FreeRTOS only on contention
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "critical_section.h"
+
+#include <cstdint>
+
+
+namespace free_rtos_std {
+
+// Intrusive list of waiting free rtos tasks: each waiter links a node that
+// lives on its own stack, so waiting doesn't allocate and a waiter that timed
+// out unlinks itself in O(1).
+//
+class task_fifo {
+public:
+    using thrd_type = TaskHandle_t;
+
+    struct node {
+        explicit node(thrd_type thrd) : task { thrd } {}
+
+        thrd_type task;
+        UBaseType_t priority {}; // set by insert()
+        node* prev {};
+        node* next {};
+        task_fifo* list {}; // the list the node is queued on
+    };
+
+    constexpr task_fifo() = default;
+
+    // returns false if the node isn't queued here, e.g. it was taken by pop() already
+    bool remove(node& n) {
+        if (n.list != this) {
+            return false;
+        }
+        (n.prev ? n.prev->next : _head) = n.next;
+        (n.next ? n.next->prev : _tail) = n.prev;
+        n.list = nullptr;
+        return true;
+    }
+    void push(node& n) {
+        n.prev = _tail;
+        n.next = nullptr;
+        n.list = this;
+        (_tail ? _tail->next : _head) = &n;
+        _tail = &n;
+    }
+    // queues the node behind those of the same or a higher priority, like a FreeRTOS event list
+    void insert(node& n) {
+        n.priority = ::uxTaskPriorityGet(n.task);
+        auto pos { _tail };
+        while (pos && pos->priority < n.priority) {
+            pos = pos->prev;
+        }
+        n.prev = pos;
+        n.next = pos ? pos->next : _head;
+        n.list = this;
+        (n.next ? n.next->prev : _tail) = &n;
+        (pos ? pos->next : _head) = &n;
+    }
+    void pop() {
+        remove(*_head);
+    }
+    // priority of the first node, the highest one if the nodes were inserted
+    UBaseType_t top_priority() const {
+        return _head ? _head->priority : tskIDLE_PRIORITY;
+    }
+    // moves all nodes of other to this list in priority order
+    void merge(task_fifo& other) {
+        while (other._head) {
+            auto& n { *other._head };
+            other.pop();
+            insert(n);
+        }
+    }
+    // may be called without holding the list's lock as a hint
+    bool empty() const {
+        return !__atomic_load_n(&_head, __ATOMIC_RELAXED);
+    }
+
+    // no copy and no move
+    task_fifo& operator=(const task_fifo& r) = delete;
+    task_fifo& operator=(task_fifo&& r) = delete;
+    task_fifo(task_fifo&&) = delete;
+    task_fifo(const task_fifo&) = delete;
+
+    thrd_type& front() {
+        return _head->task;
+    }
+    const thrd_type& front() const {
+        return _head->task;
+    }
+    thrd_type& back() {
+        return _tail->task;
+    }
+    const thrd_type& back() const {
+        return _tail->task;
+    }
+
+protected:
+    node* _head {};
+    node* _tail {};
+};
+
+// handle of the calling task as lock word
+inline uintptr_t current_task() {
+#if configNUMBER_OF_CORES > 1
+    // each task runs on its own host thread, caching the handle saves masking the signals on every call
+    static thread_local const uintptr_t task { reinterpret_cast<uintptr_t>(::xTaskGetCurrentTaskHandle()) };
+    return task;
+#else
+    return reinterpret_cast<uintptr_t>(::xTaskGetCurrentTaskHandle());
+#endif
+}
+
+// Priority inheritance of the locks below. A waiter lends the owner of a flagged lock its priority, the lock is counted
+// in the mutexes held by the owner meanwhile (see vTaskAddMutexHeld()). So the owner keeps an inherited priority until
+// it released all FreeRTOS mutexes and flagged locks, and a waiter that times out can drop it like queue.c does.
+// All of them are called in a critical section.
+//
+inline void add_held([[maybe_unused]] uintptr_t owner) {
+#if configUSE_MUTEXES == 1
+    ::vTaskAddMutexHeld(reinterpret_cast<void*>(owner));
+#endif
+}
+
+// the calling task released a flagged lock, returns true if its priority was dropped
+inline BaseType_t release_held() {
+#if configUSE_MUTEXES == 1
+    return ::xTaskPriorityDisinherit(reinterpret_cast<TaskHandle_t>(current_task()));
+#else
+    return pdFALSE;
+#endif
+}
+
+// a waiter timed out, the owner keeps the priority of the highest remaining waiter at most
+inline void disinherit_after_timeout([[maybe_unused]] uintptr_t owner, [[maybe_unused]] UBaseType_t highest_waiter) {
+#if configUSE_MUTEXES == 1
+    ::vTaskPriorityDisinheritAfterTimeout(reinterpret_cast<TaskHandle_t>(owner), highest_waiter);
+#endif
+}
+
+// Mutex behind std::mutex. The owner is an atomic word, so locking and
+// unlocking without contention is a single atomic operation and the mutex
+// allocates nothing. A task that finds it locked flags the owner word,
+// queues itself on the wait list in a critical section, lends the owner
+// its priority and blocks on a task notification. Unlocking a flagged
+// mutex wakes the first waiter and drops the inherited priority unless
+// another lock still holds it up, the woken task competes for the mutex
+// again. A waiter that times out hands back what it lent.
+// Waiters of a condition variable broadcast are moved to the wait list
+// instead of being woken all at once (wait morphing).
+//
+class gthr_mutex {
+public:
+    constexpr gthr_mutex() = default;
+
+    gthr_mutex& operator=(const gthr_mutex&) = delete;
+    gthr_mutex(const gthr_mutex&) = delete;
+
+    bool try_lock() {
+        uintptr_t expected {};
+        return __atomic_compare_exchange_n(&_owner, &expected, self(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    bool lock(TickType_t ticks) {
+        if (try_lock()) {
+            return true;
+        }
+        return ticks && lock_contended(ticks);
+    }
+    void unlock() {
+        if (__atomic_exchange_n(&_owner, 0, __ATOMIC_RELEASE) & CONTENDED) {
+            wake();
+        }
+    }
+
+    // true if the calling task holds the mutex
+    bool owned() const {
+        return (__atomic_load_n(&_owner, __ATOMIC_RELAXED) & ~CONTENDED) == self();
+    }
+
+    // locks again after a condition variable wait, the task may have been woken from the wait list
+    void relock();
+
+    // moves the waiters of a condition variable to the wait list, wakes the first one if the mutex is free
+    void morph(task_fifo& waiters);
+
+    // takes a waiter off the wait list, must be called in a critical section
+    bool remove(task_fifo::node& n) {
+        return _waiters.remove(n);
+    }
+
+private:
+    static constexpr uintptr_t CONTENDED { 1 }; // owner word flag, task handles are aligned
+
+    static uintptr_t self() {
+        return current_task();
+    }
+
+    bool lock_contended(TickType_t ticks);
+    bool acquire_or_flag(uintptr_t task);
+    void timed_out();
+    void wake();
+
+    uintptr_t _owner {}; // handle of the locking task and CONTENDED, 0 if free
+    task_fifo _waiters; // protected by critical sections
+};
+
+// Mutex behind std::recursive_mutex, a gthr_mutex with a lock count of the owner.
+//
+class gthr_recursive_mutex {
+public:
+    constexpr gthr_recursive_mutex() = default;
+
+    bool try_lock() {
+        return lock(0);
+    }
+    bool lock(TickType_t ticks) {
+        if (_mutex.owned() && _count) {
+            ++_count;
+            return true;
+        }
+        if (!_mutex.lock(ticks)) {
+            return false;
+        }
+        _count = 1;
+        return true;
+    }
+    void unlock() {
+        if (!--_count) {
+            _mutex.unlock();
+        }
+    }
+
+private:
+    gthr_mutex _mutex;
+    UBaseType_t _count {}; // only accessed by the owner
+};
+} // namespace free_rtos_std
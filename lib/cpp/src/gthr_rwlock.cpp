@@ -0,0 +1,196 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    gthr_rwlock.cpp
+ * @brief   Contended paths of the reader-writer lock and the pthread_rwlock functions used by <shared_mutex>
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ */
+
+#if (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) >= 60100
+#include "gthr_rwlock.h"
+#include "gthr_time.h"
+
+#include <algorithm>
+#include <cerrno>
+
+
+namespace free_rtos_std {
+
+// Called in a critical section. Takes the lock if the task may, flagging it again if there are more waiters,
+// otherwise flags the state so that the lock is handed on when unlocked. A flagged writer is counted once with
+// add_held() like the owner of a gthr_mutex.
+bool gthr_rwlock::acquire_or_flag(bool writer) {
+    auto state { __atomic_load_n(&_state, __ATOMIC_RELAXED) };
+    while (true) {
+        const bool free { writer ? !(state & ~CONTENDED) : !(state & WRITER) && _writers.empty() };
+        if (free) {
+            auto next { writer ? current_task() | WRITER : (state & ~CONTENDED) + READER };
+            if (!_readers.empty() || !_writers.empty()) {
+                next |= CONTENDED;
+            }
+            if (__atomic_compare_exchange_n(&_state, &state, next, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                if (writer && (next & CONTENDED)) {
+                    add_held(next & ~FLAGS);
+                }
+                return true;
+            }
+        } else if (state & CONTENDED) {
+#if configUSE_MUTEXES == 1
+            if (state & WRITER) {
+                ::xTaskPriorityInherit(reinterpret_cast<TaskHandle_t>(state & ~FLAGS));
+            }
+#endif
+            return false;
+        } else if (__atomic_compare_exchange_n(&_state, &state, state | CONTENDED, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            if (state & WRITER) {
+                add_held(state & ~FLAGS);
+#if configUSE_MUTEXES == 1
+                ::xTaskPriorityInherit(reinterpret_cast<TaskHandle_t>(state & ~FLAGS));
+#endif
+            }
+            return false;
+        }
+    }
+}
+
+// Called in a critical section after a waiter gave up, the writer keeps the priority of the remaining waiters only.
+void gthr_rwlock::timed_out() {
+    const auto state { __atomic_load_n(&_state, __ATOMIC_RELAXED) };
+    if ((state & WRITER) && (state & CONTENDED)) {
+        disinherit_after_timeout(state & ~FLAGS, std::max(_writers.top_priority(), _readers.top_priority()));
+    }
+}
+
+bool gthr_rwlock::lock_contended(bool writer, TickType_t ticks) {
+    auto& waiters { writer ? _writers : _readers };
+    task_fifo::node waiter { reinterpret_cast<TaskHandle_t>(current_task()) };
+    TimeOut_t timeout;
+    ::vTaskSetTimeOutState(&timeout);
+
+    while (true) {
+        {
+            critical_section critical;
+            if (acquire_or_flag(writer)) {
+                return true;
+            }
+            waiters.insert(waiter);
+        }
+
+        if (!::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, ticks)) {
+            critical_section critical;
+            if (waiters.remove(waiter)) {
+                timed_out(); // the state stays flagged, the next unlock wakes the others
+                return false;
+            }
+            // woken meanwhile, the notification was given when the waiter was taken off the list
+            ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, 0);
+        }
+
+        if (::xTaskCheckForTimeOut(&timeout, &ticks)) {
+            // a woken waiter must try once more, it flags the lock for the remaining waiters
+            critical_section critical;
+            if (acquire_or_flag(writer)) {
+                return true;
+            }
+            timed_out();
+            return false;
+        }
+    }
+}
+
+void gthr_rwlock::wake(bool writer) {
+    BaseType_t yield {};
+    {
+        critical_section critical;
+        if (!writer) {
+            if (__atomic_load_n(&_state, __ATOMIC_RELAXED) != CONTENDED) {
+                return; // taken by a waiter meanwhile, it flagged the state again
+            }
+            // no one can take the flagged lock without a critical section
+            __atomic_store_n(&_state, 0, __ATOMIC_RELAXED);
+        }
+
+        if (!_writers.empty()) {
+            const auto task { _writers.front() };
+            _writers.pop(); // before the notification, it may switch to the task
+            ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+        } else {
+            while (!_readers.empty()) {
+                const auto task { _readers.front() };
+                _readers.pop();
+                ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+            }
+        }
+        if (writer) {
+            yield = release_held();
+        }
+    }
+
+    if (yield) {
+        taskYIELD();
+    }
+}
+
+
+static gthr_rwlock* rwlock_cast(pthread_rwlock_t* rwlock) {
+    return reinterpret_cast<gthr_rwlock*>(rwlock);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock) {
+    return rwlock_cast(rwlock)->lock_shared(portMAX_DELAY) ? 0 : EDEADLK;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t* rwlock) {
+    return rwlock_cast(rwlock)->try_lock_shared() ? 0 : EBUSY;
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t* rwlock, const timespec* abs_timeout) {
+    return free_rtos_std::pthread_rwlock_clockrdlock(rwlock, CLOCK_REALTIME, abs_timeout);
+}
+
+int pthread_rwlock_clockrdlock(pthread_rwlock_t* rwlock, clockid_t clock, const timespec* abs_timeout) {
+    const auto lock { rwlock_cast(rwlock) };
+    return lock_until(clock, *abs_timeout, [lock](TickType_t ticks) { return lock->lock_shared(ticks); }) ? 0 : ETIMEDOUT;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock) {
+    return rwlock_cast(rwlock)->lock(portMAX_DELAY) ? 0 : EDEADLK;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t* rwlock) {
+    return rwlock_cast(rwlock)->try_lock() ? 0 : EBUSY;
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t* rwlock, const timespec* abs_timeout) {
+    return free_rtos_std::pthread_rwlock_clockwrlock(rwlock, CLOCK_REALTIME, abs_timeout);
+}
+
+int pthread_rwlock_clockwrlock(pthread_rwlock_t* rwlock, clockid_t clock, const timespec* abs_timeout) {
+    const auto lock { rwlock_cast(rwlock) };
+    return lock_until(clock, *abs_timeout, [lock](TickType_t ticks) { return lock->lock(ticks); }) ? 0 : ETIMEDOUT;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t* rwlock) {
+    rwlock_cast(rwlock)->unlock();
+    return 0;
+}
+
+} // namespace free_rtos_std
+#endif // GCC VERSION >= 60100
@@ -0,0 +1,124 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    gthr_rwlock.h
+ * @brief   Reader-writer lock behind std::shared_mutex and std::shared_timed_mutex
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "gthr_mutex.h"
+
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+
+
+namespace free_rtos_std {
+
+// Reader-writer lock on one atomic state word: the number of readers, or the
+// handle of the writing task, plus a writer flag and a contended flag. Taking
+// and releasing it without contention is a single atomic operation. Tasks that
+// have to wait queue themselves on the reader or the writer list and block on
+// a task notification like on a gthr_mutex, a waiting task lends a writer its
+// priority. Waiting writers are preferred: once a writer is queued, new readers
+// queue as well. Unlocking wakes the first writer or else all readers.
+// The lock is all zero when free, so it lives in the storage of the
+// pthread_rwlock_t that <shared_mutex> initialises with
+// PTHREAD_RWLOCK_INITIALIZER.
+//
+class gthr_rwlock {
+public:
+    constexpr gthr_rwlock() = default;
+
+    gthr_rwlock& operator=(const gthr_rwlock&) = delete;
+    gthr_rwlock(const gthr_rwlock&) = delete;
+
+    bool try_lock_shared() {
+        auto state { __atomic_load_n(&_state, __ATOMIC_RELAXED) };
+        while (!(state & (WRITER | CONTENDED))) {
+            if (__atomic_compare_exchange_n(&_state, &state, state + READER, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool lock_shared(TickType_t ticks) {
+        if (try_lock_shared()) {
+            return true;
+        }
+        return ticks && lock_contended(false, ticks);
+    }
+
+    bool try_lock() {
+        uintptr_t expected {};
+        return __atomic_compare_exchange_n(&_state, &expected, current_task() | WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    bool lock(TickType_t ticks) {
+        if (try_lock()) {
+            return true;
+        }
+        return ticks && lock_contended(true, ticks);
+    }
+
+    // releases a shared or an exclusive lock, like pthread_rwlock_unlock()
+    void unlock() {
+        auto state { __atomic_load_n(&_state, __ATOMIC_RELAXED) };
+        if (state & WRITER) {
+            if (__atomic_exchange_n(&_state, 0, __ATOMIC_RELEASE) & CONTENDED) {
+                wake(true);
+            }
+        } else if (__atomic_sub_fetch(&_state, READER, __ATOMIC_RELEASE) == CONTENDED) {
+            wake(false); // the last reader
+        }
+    }
+
+private:
+    static constexpr uintptr_t WRITER { 1 };
+    static constexpr uintptr_t CONTENDED { 2 }; // task handles are aligned, so both flags fit below them
+    static constexpr uintptr_t READER { 4 };
+    static constexpr uintptr_t FLAGS { WRITER | CONTENDED };
+
+    bool lock_contended(bool writer, TickType_t ticks);
+    bool acquire_or_flag(bool writer);
+    void timed_out();
+    void wake(bool writer);
+
+    uintptr_t _state {}; // readers * READER or the writing task | WRITER, plus CONTENDED
+    task_fifo _readers; // protected by critical sections
+    task_fifo _writers; // protected by critical sections
+};
+
+static_assert(sizeof(gthr_rwlock) <= sizeof(pthread_rwlock_t) && alignof(gthr_rwlock) <= alignof(pthread_rwlock_t));
+
+// <shared_mutex> calls these through __gthrw_() and the pthread_rwlock_clock overloads, see gthr-default.h
+int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t* rwlock);
+int pthread_rwlock_timedrdlock(pthread_rwlock_t* rwlock, const timespec* abs_timeout);
+int pthread_rwlock_clockrdlock(pthread_rwlock_t* rwlock, clockid_t clock, const timespec* abs_timeout);
+int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock);
+int pthread_rwlock_trywrlock(pthread_rwlock_t* rwlock);
+int pthread_rwlock_timedwrlock(pthread_rwlock_t* rwlock, const timespec* abs_timeout);
+int pthread_rwlock_clockwrlock(pthread_rwlock_t* rwlock, clockid_t clock, const timespec* abs_timeout);
+int pthread_rwlock_unlock(pthread_rwlock_t* rwlock);
+} // namespace free_rtos_std
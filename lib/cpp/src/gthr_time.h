@@ -0,0 +1,110 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    gthr_time.h
+ * @brief   Absolute timeouts of the C++ thread support on the clock of freertos::get_us()
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "portable/posix.h"
+
+#include <cstdint>
+#include <ctime>
+
+
+#ifndef configPOSIX_SCALED_STEADY_CLOCK
+#define configPOSIX_SCALED_STEADY_CLOCK 0
+#endif
+
+// std::chrono::steady_clock runs on the clock of freertos::get_us() with virtual time, or if the application scales time
+// with vPortSetTickPeriodUs() and sets configPOSIX_SCALED_STEADY_CLOCK (see thread.cpp). Otherwise it stays the host clock.
+#define GTHR_STEADY_CLOCK_PORT_TIME (configUSE_POSIX_VIRTUAL_TIME == 1 || configPOSIX_SCALED_STEADY_CLOCK == 1)
+
+
+namespace free_rtos_std {
+
+// Timed waits take place on the clock of freertos::get_us(), scaled by
+// vPortSetTickPeriodUs() and simulated with configUSE_POSIX_VIRTUAL_TIME, so they
+// take as long as std::this_thread::sleep_for(). A timeout on a steady_clock that
+// runs on that clock is the deadline already. Other timeouts, e.g. of
+// std::chrono::system_clock, which always is the host wall clock, are converted
+// with the time left on their host clock when the wait starts. As the C++ library
+// compares a timeout with the clock it was given on, a wait on system_clock reports
+// no timeout when time runs faster than the wall clock; use steady_clock there.
+// The waits block in FreeRTOS for the whole ticks until the deadline. Blocking for
+// n ticks ends between n - 1 and n tick periods later, so the rest, shorter than
+// two ticks, passes with freertos::delay_us(), which doesn't sleep on the host with
+// virtual time.
+//
+inline uint64_t now_ns() {
+#if configUSE_POSIX_VIRTUAL_TIME == 1
+    return ::ullPortGetVirtualTimeUs() * 1'000ULL;
+#else
+    return ::ullPortGetTimeNs();
+#endif
+}
+
+// deadline on the clock of now_ns() for abs_time on the clock passed by the C++ library
+inline uint64_t deadline_ns(clockid_t clock, const timespec& abs_time) {
+    const int64_t abs_ns { abs_time.tv_sec * 1'000'000'000LL + abs_time.tv_nsec };
+#if GTHR_STEADY_CLOCK_PORT_TIME
+    if (clock == CLOCK_MONOTONIC) {
+        return abs_ns > 0 ? static_cast<uint64_t>(abs_ns) : 0;
+    }
+#endif
+    timespec now;
+    ::clock_gettime(clock, &now);
+    const int64_t left { abs_ns - (now.tv_sec * 1'000'000'000LL + now.tv_nsec) };
+    return now_ns() + (left > 0 ? static_cast<uint64_t>(left) : 0);
+}
+
+// whole ticks until the deadline
+inline TickType_t ticks_until(uint64_t deadline) {
+    const auto now { now_ns() };
+    return deadline > now ? static_cast<TickType_t>((deadline - now) / (portTICK_RATE_MICROSECONDS * 1'000ULL)) : 0;
+}
+
+// lets the rest of the time until the deadline pass, returns right away if it has passed
+inline void sleep_until(uint64_t deadline) {
+    const auto now { now_ns() };
+    if (deadline > now) {
+        freertos::delay_us(static_cast<uint32_t>((deadline - now + 999) / 1'000ULL));
+    }
+}
+
+// calls lock(ticks) with the whole ticks until abs_time, and lock(0) once more after the rest passed
+template <typename F>
+bool lock_until(clockid_t clock, const timespec& abs_time, F lock) {
+    const auto deadline { deadline_ns(clock, abs_time) };
+    if (lock(ticks_until(deadline))) {
+        return true;
+    }
+    if (now_ns() >= deadline) {
+        return false;
+    }
+    sleep_until(deadline);
+    return lock(0);
+}
+
+} // namespace free_rtos_std
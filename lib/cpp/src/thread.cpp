@@ -40,6 +40,7 @@
 #include "gthr_key_type.h"
 
 #include <thread>
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 
@@ -48,20 +49,59 @@
 void __pthread_key_create() {}
 void pthread_cancel() {}
 
-extern "C" {
-int __gthread_once(__gthread_once_t* once, void (*func)(void)) {
-    static __gthread_mutex_t s_m { xSemaphoreCreateMutex() };
-    if (!s_m) {
-        return 12; // POSIX error: ENOMEM
+// states of a __gthread_once_t besides __GTHREAD_ONCE_INIT
+static constexpr __gthread_once_t ONCE_RUNNING { 1 };
+static constexpr __gthread_once_t ONCE_WAITING { 2 }; // running and other tasks wait for it
+static constexpr __gthread_once_t ONCE_DONE { 3 };
+
+static free_rtos_std::task_fifo s_once_waiters; // tasks waiting for any once function, protected by critical sections
+
+// sets the final state after the once function returned or threw, wakes the waiting tasks to check their flags
+struct once_finish {
+    ~once_finish() {
+        if (__atomic_exchange_n(once, state, __ATOMIC_RELEASE) != ONCE_WAITING) {
+            return;
+        }
+
+        free_rtos_std::critical_section critical;
+        while (!s_once_waiters.empty()) {
+            const auto task { s_once_waiters.front() };
+            s_once_waiters.pop(); // before the notification, it may switch to the task
+            ::xTaskNotifyGiveIndexed(task, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+        }
     }
 
-    __gthread_once_t flag { true };
-    xSemaphoreTakeRecursive(s_m, portMAX_DELAY);
-    std::swap(*once, flag);
-    xSemaphoreGiveRecursive(s_m);
+    __gthread_once_t* once;
+    __gthread_once_t state; // like pthread_once() the function is called again by a later call if it threw
+};
 
-    if (flag == false) {
-        func();
+extern "C" {
+int __gthread_once(__gthread_once_t* once, void (*func)(void)) {
+    auto state { __atomic_load_n(once, __ATOMIC_ACQUIRE) };
+    while (state != ONCE_DONE) {
+        if (state == __GTHREAD_ONCE_INIT) {
+            if (__atomic_compare_exchange_n(once, &state, ONCE_RUNNING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                once_finish finish { once, __GTHREAD_ONCE_INIT };
+                func();
+                finish.state = ONCE_DONE;
+                break;
+            }
+            continue;
+        }
+
+        // another task runs the function, wait for it
+        free_rtos_std::task_fifo::node waiter { ::xTaskGetCurrentTaskHandle() };
+        {
+            free_rtos_std::critical_section critical;
+            // read again, the function may have finished and woken the waiters since the state was read
+            state = __atomic_load_n(once, __ATOMIC_ACQUIRE);
+            if (state != ONCE_WAITING && (state != ONCE_RUNNING || !__atomic_compare_exchange_n(once, &state, ONCE_WAITING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))) {
+                continue; // finished or reset meanwhile
+            }
+            s_once_waiters.push(waiter);
+        }
+        ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, portMAX_DELAY);
+        state = __atomic_load_n(once, __ATOMIC_ACQUIRE);
     }
 
     return 0;
@@ -74,44 +114,19 @@ int __gthread_active_p() {
 
 
 int __gthread_cond_timedwait(__gthread_cond_t* cond, __gthread_mutex_t* mutex, const __gthread_time_t* abs_timeout) {
-    auto this_thrd_hndl { __gthread_t::native_task_handle() };
-    cond->lock();
-    cond->push(this_thrd_hndl);
-    cond->unlock();
-
-    timeval now {};
-    gettimeofday(&now, NULL);
-
-    auto ms { static_cast<int32_t>((*abs_timeout - now).milliseconds()) };
-    if (ms < 0) {
-        ms = 0;
-    }
-
-    __gthread_mutex_unlock(mutex);
-    const auto fTimeout { 0 == ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, pdMS_TO_TICKS(ms)) };
-    __gthread_mutex_lock(mutex);
-
-    int result {};
-    if (fTimeout) { // timeout - remove the thread from the waiting list
-        cond->lock();
-        cond->remove(this_thrd_hndl);
-        cond->unlock();
-        result = 138; // posix ETIMEDOUT
-    }
-
-    return result;
+    return pthread_cond_clockwait(cond, mutex, CLOCK_REALTIME, abs_timeout);
 }
-
 int __gthread_cond_wait(__gthread_cond_t* cond, __gthread_mutex_t* mutex) {
-    auto this_thrd_hndl { __gthread_t::native_task_handle() };
+    __gthread_cond_t::node waiter { __gthread_t::native_task_handle() };
     cond->lock();
-    cond->push(this_thrd_hndl);
+    cond->push(waiter, mutex);
     cond->unlock();
 
     __gthread_mutex_unlock(mutex);
     const auto res { ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, portMAX_DELAY) };
-    __gthread_mutex_lock(mutex);
+    mutex->relock();
     configASSERT(res == pdTRUE);
+    configASSERT(!waiter.list); // notifications are only given to waiters taken off the list
 
     return static_cast<int>(res);
 }
@@ -130,41 +145,55 @@ int __gthread_cond_signal(__gthread_cond_t* cond) {
     return 0; // FIXME: return value?
 }
 
+// on a single core the waiters are not woken here but moved to the mutex and woken one by one as it is released
 int __gthread_cond_broadcast(__gthread_cond_t* cond) {
     configASSERT(cond);
 
     cond->lock();
-    while (!cond->empty()) {
-        auto t = cond->front();
-        cond->pop();
-        ::xTaskNotifyGiveIndexed(t, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
-    }
+    cond->morph();
     cond->unlock();
     return 0; // FIXME: return value?
 }
 
 } // extern C
 
-namespace free_rtos_std {
-extern Key* s_key;
-} // namespace free_rtos_std
+int pthread_cond_clockwait(__gthread_cond_t* cond, __gthread_mutex_t* mutex, clockid_t clock, const __gthread_time_t* abs_timeout) {
+    __gthread_cond_t::node waiter { __gthread_t::native_task_handle() };
+    cond->lock();
+    cond->push(waiter, mutex);
+    cond->unlock();
+
+    const auto deadline { free_rtos_std::deadline_ns(clock, *abs_timeout) };
+    __gthread_mutex_unlock(mutex);
+    const auto fTimeout { 0 == ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, free_rtos_std::ticks_until(deadline)) };
+
+    int result {};
+    if (fTimeout) { // timeout - remove the thread from the waiting list or the wait list of the mutex
+        free_rtos_std::sleep_until(deadline); // the rest of the timeout, shorter than two ticks
+        cond->lock();
+        if (cond->remove(waiter)) {
+            result = ETIMEDOUT;
+        } else {
+            // notified meanwhile, the notification was given when the waiter was taken off the list
+            ::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, 0);
+        }
+        cond->unlock();
+    }
+    mutex->relock();
+
+    return result;
+}
 
 namespace std {
 
+// called by gthr_freertos::task_main(), which releases joined threads afterwards
 static void __execute_native_thread_routine(void* __p) {
-    __gthread_t local { *static_cast<__gthread_t*>(__p) }; // copy
-
     { // we own the arg now; it must be deleted after run() returns
-        thread::_State_ptr __t { static_cast<thread::_State*>(local.arg()) };
-        local.notify_started(); // copy has been made; tell we are running
+        thread::_State_ptr __t { static_cast<thread::_State*>(__p) };
         __t->_M_run();
     }
 
-    if (free_rtos_std::s_key) {
-        free_rtos_std::s_key->CallDestructor(__gthread_t::self().native_task_handle());
-    }
-
-    local.notify_joined(); // finished; release joined threads
+    free_rtos_std::freertos_gthread_key_destruct();
 }
 
 thread::_State::~_State() = default;
@@ -213,24 +242,32 @@ void thread::detach() {
 //    Number of concurrent threads supported. If the value is not well defined
 //    or not computable, returns ​0​.
 unsigned int thread::hardware_concurrency() noexcept {
-    return 1;
+    return configNUMBER_OF_CORES;
 }
 
+#if GTHR_STEADY_CLOCK_PORT_TIME
+namespace chrono {
+// runs like freertos::get_us(), so timeouts and sleeps on it take application time, see gthr_time.h
+steady_clock::time_point steady_clock::now() noexcept {
+    return time_point { nanoseconds { free_rtos_std::now_ns() } };
+}
+} // namespace chrono
+#endif // GTHR_STEADY_CLOCK_PORT_TIME
+
 namespace this_thread {
+// whole ticks with vTaskDelay(), the rest of a tick on the host, see freertos::delay_us()
 void __sleep_for(chrono::seconds sec, chrono::nanoseconds nsec) {
-    long ms = nsec.count() / 1'000'000;
-    if (sec.count() == 0 && ms == 0 && nsec.count() > 0) {
-        ms = 1; // round up to 1 ms => if sleep time != 0, sleep at least 1ms
+    for (auto us { chrono::ceil<chrono::microseconds>(sec + nsec).count() }; us > 0; us -= UINT32_MAX) {
+        freertos::delay_us(static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX)));
     }
-
-    vTaskDelay(pdMS_TO_TICKS(chrono::milliseconds(sec).count() + ms));
 }
 } // namespace this_thread
 } // namespace std
 
 namespace free_rtos_std {
 
-StackType_t gthr_freertos::next_stack_size_ {};
+thread_local StackType_t gthr_freertos::next_stack_size_ {};
+thread_local const thread_attributes* gthr_freertos::next_attributes_ {};
 
 StackType_t gthr_freertos::set_next_stacksize(const StackType_t size) {
     const StackType_t last { next_stack_size_ };
@@ -246,6 +283,9 @@ void gthr_freertos::set_name(std::thread* p_thread, const char* task_name) {
     auto p_name { ::pcTaskGetName(p_thread->native_handle().get_native_handle()) };
     std::strncpy(p_name, task_name, configMAX_TASK_NAME_LEN - 1);
     p_name[configMAX_TASK_NAME_LEN - 1] = 0;
+#if configUSE_POSIX_TRACE_RECORDER == 1
+    ::vTraceRecordTaskName(p_thread->native_handle().get_native_handle(), p_name);
+#endif
 }
 
 void gthr_freertos::suspend(std::thread* p_thread) {
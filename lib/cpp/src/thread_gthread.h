@@ -39,7 +39,6 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "portable/posix.h"
-#include "event_groups.h"
 #include "critical_section.h"
 
 #include <utility>
@@ -52,173 +51,108 @@ class stop_token;
 
 namespace free_rtos_std {
 
+// Attributes of the task of a std::thread, see make_thread()
+struct thread_attributes {
+    const char* name { "Task" };
+    StackType_t stack_size {}; // byte, 0: the size set with gthr_freertos::set_next_stacksize() or the default size
+    UBaseType_t priority { tskIDLE_PRIORITY + 1 };
+    UBaseType_t core_affinity { tskNO_AFFINITY }; // with configUSE_CORE_AFFINITY
+    // With both set the task is created statically in these buffers, they must stay valid until the thread has finished.
+    // stack_size is the size of stack_buffer then and must be given.
+    StackType_t* stack_buffer {};
+    StaticTask_t* task_buffer {};
+};
+
 class gthr_freertos {
     // 1. std::thread class has a single member variable representing
     //    a native thread handle
     // 2. Detach requires that the native thread function will execute
     //    even if the std::thread instance has been destroyed. The native
     //    thread function must take the ownership of any resources allocated
-    //    during the thread creation. This could be the thread handle itself.
-    //    Detach must make sure that the thread has started execution and
-    //    the ownership has been taken.
+    //    during the thread creation.
     // 3. Join requires a way to switch the current context to a waiting
     //    state. The native thread function must have a way to unlock
     //    a joined thread.
     // 4. FreeRTOS does not have an interface implementing join. It is possible
     //    to suspend a thread but the thread we are waiting for to join is not
-    //    aware which thread is waiting.  Is this statement wrong?
-    // 5. Solution is to use events group.
-    //    The handle life time must be handled by this class.
-    // 6. Life time of thread handle and events group handle is not the same.
-    //    There are two cases:
+    //    aware which thread is waiting.
+    // 5. Solution is a small control block shared by the std::thread and its
+    //    task. The task gets it as its parameter, so it owns its reference from
+    //    the start and detach need not wait for the task to run. A joining task
+    //    registers itself in the block and waits for a task notification.
+    // 6. Life time of the task and the std::thread instance is not the same:
     //     a) detach is called and std::thread instance is destroyed; in this case
     //        thread function outlives the thread instance
     //     b) thread function exits first; in this case the thread instance
-    //        outlives the thread function; join must have access to the events
-    //        group to check whether the thread function has finished or not.
-    //    So, the thread handle must exist as long as thread function executes.
-    //    The events group must live as long as std::thread instance exists.
-    // 7. Although the living time is different for two handles,
-    //    see pt. 1 -only one member variable to handle free rtos interface.
-    //    For this reason a single class is a container for the two handles.
+    //        outlives the thread function; join must still see that the thread
+    //        function has finished.
+    //    So the block is reference counted, whoever releases it last deletes it.
+    // 7. Copies of this class (std::thread::id) hold only the task handle, the
+    //    one in the std::thread holds the reference to the block as well.
 
     friend std::thread;
     friend std::stop_token;
 
-    enum { eEvStoragePos = 0, eStartedEv = 1 << 22, eJoinEv = 1 << 23 };
+    struct control_block;
 
     static constexpr StackType_t DEFAULT_STACK_SIZE { 2 * 1024 }; // byte
-    static StackType_t next_stack_size_;
+    // set by the creating task, so each task has its own
+    static thread_local StackType_t next_stack_size_;
+    static thread_local const thread_attributes* next_attributes_;
 
 public:
     typedef void (*task_foo)(void*);
     typedef TaskHandle_t native_task_type;
 
-    gthr_freertos(const gthr_freertos& r) {
-        critical_section critical;
-
-        _taskHandle = r._taskHandle;
-        _evHandle = r._evHandle;
-        _arg = r._arg;
-        _fOwner = false; // it is just a copy
-    }
+    gthr_freertos(const gthr_freertos& r) : _taskHandle { r._taskHandle } {} // just a copy, not the owner
 
     gthr_freertos(gthr_freertos&& r) {
-        taskENTER_CRITICAL();
-        if (r._fOwner) {
-            taskEXIT_CRITICAL();
-            // make sure it has already started
-            // - native thread function must make local copies first
-            r.wait_for_start();
-            taskENTER_CRITICAL();
-        }
-        // 'this' becomes the owner if r is the owner
         move(std::forward<gthr_freertos>(r));
-        taskEXIT_CRITICAL();
     }
 
 #if __GNUC__ < 11
-    gthr_freertos(int id) : gthr_freertos { nullptr, nullptr } {
+    gthr_freertos(int id) : gthr_freertos { nullptr } {
         configASSERT(id == 1); // just to satisfy the case !__gthread_active_p()
         configASSERT(false); // not supported
     }
 #endif // __GNUC__ < 11
 
     bool create_thread(task_foo foo, void* arg) {
-        _arg = arg;
-
-        _evHandle = xEventGroupCreate();
-        // if (!_evHandle) {
-        //     std::terminate();
-        // }
-        configASSERT(_evHandle);
-
-        {
-            critical_section critical;
-
-            xTaskCreate(foo, "Task", next_stack_size_ ? next_stack_size_ / sizeof(StackType_t) : DEFAULT_STACK_SIZE / sizeof(StackType_t), this,
-                tskIDLE_PRIORITY + 1, &_taskHandle);
-            // if (!_taskHandle) {
-            //     std::terminate();
-            // }
-            configASSERT(_taskHandle);
-
-            vTaskSetThreadLocalStoragePointer(_taskHandle, eEvStoragePos, _evHandle);
-            _fOwner = true;
+        // from the kernel heap, the host malloc() must not be interrupted by a task switch
+        _block = static_cast<control_block*>(pvPortMalloc(sizeof(control_block)));
+        if (!_block) {
+            return false;
         }
+        *_block = { foo, arg, 0, 2 };
 
-        return true;
-    }
-
-    void join() { // note 1: _evHandle must be valid here. Even if the native thread function
-        //   has finished and got destroyed the _taskHandle, it
-        //   must not release the _evHandle!
-        //
-        // note 2: The native thread function must call notify_joined when it has
-        //   finished. Even if 'join' is called after that, the bits are set
-        //   and event group will not block. So it is safe to call wait here.
-        //
-        // note 3: Instead of keeping _evHandle, it could be possible to read
-        //   it from the local storage of the task. However, that would require
-        //   checking if the task still exists and use critical section if it does.
-        //   It is faster to use _evHandle directly, even if it is an extra item to
-        //   copy each time when this instance is copied.
-        while (0 == xEventGroupWaitBits(_evHandle, eJoinEv | eStartedEv, pdFALSE, pdTRUE, portMAX_DELAY))
-            ;
-    }
-
-    void detach() { // Detaching is removing the event's object. It can be done
-        // only if the thread has started execution.
-        wait_for_start();
-
-        { // unfortunately critical section is needed here to make sure
-            // the task is not deleted while accessing the task's local storage.
-            critical_section critical;
-
-            if (eDeleted != eTaskGetState(_taskHandle)) {
-                vTaskSetThreadLocalStoragePointer(_taskHandle, eEvStoragePos, nullptr);
-                vEventGroupDelete(_evHandle);
-
-                // Thread still exists but detach removes ownership.
-                // Ownership belongs to the native thread. It will release the task
-                // handle once user's thread function exits.
-                _fOwner = false;
-            }
+        create_task();
+        if (!_taskHandle) {
+            vPortFree(_block);
+            _block = nullptr;
+            return false;
         }
-    }
 
-    void notify_started() { // Function should be called only from the controlled task
-        // and only when the (internal, not application's one) thread function
-        // has started execution.
-        xEventGroupSetBits(_evHandle, eStartedEv);
+        return true;
     }
 
-    void notify_joined() { // Function should be called only from the controlled task
-        // and only when the thread function has finished execution.
-        {
-            critical_section critical;
-
-            // Note: The _evHandle may be invalid if thread has been detached.
-            //    It is required to get the handle from the thread itself.
-            //    The detach function will set this handle to nullptr.
-            auto evHnd = static_cast<EventGroupHandle_t>(pvTaskGetThreadLocalStoragePointer(_taskHandle, eEvStoragePos));
-
-            if (evHnd) {
-                xEventGroupSetBits(evHnd, eJoinEv);
-            } else {
-                // thread has been detached, nothing to do
+    void join() {
+        uintptr_t running {};
+        if (__atomic_compare_exchange_n(&_block->state, &running, reinterpret_cast<uintptr_t>(::xTaskGetCurrentTaskHandle()), false, __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE)) {
+            // registered, the task gives exactly one notification when it has finished
+            while (!::ulTaskNotifyTakeIndexed(configTASK_NOTIFICATION_ARRAY_ENTRIES - 1, pdTRUE, portMAX_DELAY)) {
             }
         }
+        release();
+    }
 
-        // vTaskDelete will not return
-        vTaskDelete(nullptr);
-        configASSERT(0);
+    void detach() {
+        // the task keeps its own reference and releases it once it has finished
+        release();
     }
 
     static gthr_freertos self() {
-        auto tHnd = xTaskGetCurrentTaskHandle();
-        auto evHnd = static_cast<EventGroupHandle_t>(pvTaskGetThreadLocalStoragePointer(tHnd, eEvStoragePos));
-        return gthr_freertos { tHnd, evHnd };
+        return gthr_freertos { ::xTaskGetCurrentTaskHandle() };
     }
 
     static native_task_type native_task_handle() {
@@ -247,12 +181,13 @@ public:
     }
 #endif
 
-    void* arg() const {
-        return _arg;
-    }
-
     static StackType_t set_next_stacksize(const StackType_t size);
 
+    // the next thread the calling task creates gets these attributes, nullptr for the default ones
+    static void set_next_attributes(const thread_attributes* attributes) {
+        next_attributes_ = attributes;
+    }
+
     static void set_priority(std::thread* p_thread, const uint32_t prio);
 
     static void set_name(std::thread* p_thread, const char* task_name);
@@ -267,61 +202,110 @@ public:
     gthr_freertos& operator=(const gthr_freertos& r) = delete;
 
 private:
+    struct control_block {
+        task_foo foo;
+        void* arg;
+        uintptr_t state; // 0: running, FINISHED or the task waiting in join()
+        uint8_t refs; // the std::thread and the task
+    };
+    static constexpr uintptr_t FINISHED { 1 };
+
     gthr_freertos() = default;
 
-    gthr_freertos(native_task_type thnd, EventGroupHandle_t ehnd) : _taskHandle { thnd }, _evHandle { ehnd } {}
+    explicit gthr_freertos(native_task_type thnd) : _taskHandle { thnd } {}
 
     gthr_freertos& operator=(gthr_freertos&& r) {
         if (this == &r) {
             return *this;
         }
 
-        taskENTER_CRITICAL();
-
-        if (_fOwner) { // If 'r' is the owner then 'this' will get the
-            // new ownership. If 'r' is not the owner then
-            // just a copy is being moved. Either way 'this'
-            // ownership is lost and handles must be deleted.
-            if (eDeleted != eTaskGetState(_taskHandle)) {
-                vTaskDelete(_taskHandle);
-            }
-            if (_evHandle) {
-                vEventGroupDelete(_evHandle);
-            }
-            _fOwner = false;
-        } else if (r._fOwner) {
-            taskEXIT_CRITICAL();
-            // make sure it has already started
-            // - native thread function must make local copies first
-            r.wait_for_start();
-            taskENTER_CRITICAL();
+        if (_block) { // std::thread terminates before, like a detach otherwise
+            release();
         }
-        // 'this' becomes the owner if r is the owner
         move(std::forward<gthr_freertos>(r));
-        taskEXIT_CRITICAL();
         return *this;
     }
 
     void move(gthr_freertos&& r) {
         _taskHandle = r._taskHandle;
-        _evHandle = r._evHandle;
-        _arg = r._arg;
-        _fOwner = r._fOwner;
+        _block = r._block; // 'this' becomes the owner if r is the owner
         r._taskHandle = nullptr;
-        r._evHandle = nullptr;
-        r._arg = nullptr;
-        r._fOwner = false;
+        r._block = nullptr;
+    }
+
+    void release() {
+        release(_block);
+        _block = nullptr;
+    }
+
+    static void release(control_block* block) {
+        if (!__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL)) {
+            vPortFree(block);
+        }
+    }
+
+    // the task function of every thread
+    static void task_main(void* param) {
+        const auto block { static_cast<control_block*>(param) };
+        block->foo(block->arg);
+
+        // finished; release a joined thread
+        const auto joiner { reinterpret_cast<TaskHandle_t>(__atomic_exchange_n(&block->state, FINISHED, __ATOMIC_ACQ_REL)) };
+        release(block); // the std::thread still holds its reference if there is a joiner
+        if (joiner) {
+            ::xTaskNotifyGiveIndexed(joiner, configTASK_NOTIFICATION_ARRAY_ENTRIES - 1);
+        }
+
+        // vTaskDelete will not return
+        vTaskDelete(nullptr);
+        configASSERT(0);
     }
 
-    void wait_for_start() {
-        while (0 == xEventGroupWaitBits(_evHandle, eStartedEv, pdFALSE, pdTRUE, portMAX_DELAY))
-            ;
+    // creates the task with the attributes passed for it
+    void create_task() {
+        static constexpr thread_attributes defaults {};
+        const auto& attr { next_attributes_ ? *next_attributes_ : defaults };
+        next_attributes_ = nullptr;
+
+#if configSUPPORT_STATIC_ALLOCATION == 1
+        if (attr.stack_buffer || attr.task_buffer) {
+            // both buffers and the size of the stack buffer, a default size could exceed it
+            configASSERT(attr.stack_buffer && attr.task_buffer && attr.stack_size);
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY == 1
+            _taskHandle = xTaskCreateStaticAffinitySet(task_main, attr.name, attr.stack_size / sizeof(StackType_t), _block, attr.priority,
+                attr.stack_buffer, attr.task_buffer, attr.core_affinity);
+#else
+            _taskHandle = xTaskCreateStatic(task_main, attr.name, attr.stack_size / sizeof(StackType_t), _block, attr.priority, attr.stack_buffer, attr.task_buffer);
+#endif
+            return;
+        }
+#endif // configSUPPORT_STATIC_ALLOCATION
+
+        const auto stack_size { attr.stack_size ? attr.stack_size : next_stack_size_ ? next_stack_size_ : DEFAULT_STACK_SIZE };
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY == 1
+        xTaskCreateAffinitySet(task_main, attr.name, stack_size / sizeof(StackType_t), _block, attr.priority, attr.core_affinity, &_taskHandle);
+#else
+        xTaskCreate(task_main, attr.name, stack_size / sizeof(StackType_t), _block, attr.priority, &_taskHandle);
+#endif
     }
 
     native_task_type _taskHandle { nullptr };
-    EventGroupHandle_t _evHandle { nullptr };
-    void* _arg { nullptr };
-    bool _fOwner { false };
+    control_block* _block { nullptr }; // only set in the std::thread, see 7.
 };
 
+// Creates a std::thread or std::jthread whose task is created with the attributes right away, so no priority change or
+// renaming is needed once it runs, e.g.
+//   auto t { free_rtos_std::make_thread({ .name = "worker", .priority = 3 }, func, arg) };
+template <class Thread = std::thread, class F, class... Args>
+Thread make_thread(const thread_attributes& attributes, F&& f, Args&&... args) {
+    struct reset {
+        ~reset() {
+            gthr_freertos::set_next_attributes(nullptr); // if the thread wasn't created
+        }
+    } guard;
+
+    gthr_freertos::set_next_attributes(&attributes);
+    return Thread { std::forward<F>(f), std::forward<Args>(args)... };
+}
+
 } // namespace free_rtos_std
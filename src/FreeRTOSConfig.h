@@ -51,11 +51,19 @@ extern "C" {
 
 #define configUSE_PREEMPTION                        1
 #define configUSE_TICKLESS_IDLE                     1
+#define configUSE_POSIX_VIRTUAL_TIME                0 /* simulated clock, ticks only advance while all tasks are blocked */
+#define configPOSIX_TIME_CLOCK                      CLOCK_MONOTONIC /* host clock of freertos::get_us(), CLOCK_MONOTONIC_COARSE is cheaper with jiffy resolution */
+#define configPOSIX_SCALED_STEADY_CLOCK             0 /* 1: std::chrono::steady_clock follows freertos::get_us(), for applications that call vPortSetTickPeriodUs(); always so with virtual time */
 #define configTICK_RATE_HZ                          ( (TickType_t) 1000 )
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION     0
 #define configMAX_PRIORITIES                        ( 10 )
 #define configMINIMAL_STACK_SIZE                    ( 120 )
 #define configMAX_TASK_NAME_LEN                     ( 10 )
+#define configNUMBER_OF_CORES                       1 /* > 1: tasks run in parallel on that many host threads, requires configUSE_TICKLESS_IDLE == 0 */
+#define configRUN_MULTIPLE_PRIORITIES               1 /* with more than one core, lower priority tasks may run alongside higher ones */
+#define configUSE_PASSIVE_IDLE_HOOK                 1 /* with more than one core, the default hook lets idle cores wait for a signal instead of spinning */
+#define configUSE_CORE_AFFINITY                     ( configNUMBER_OF_CORES > 1 ) /* vTaskCoreAffinitySet(), only available with more than one core */
+#define configUSE_POSIX_CORE_PINNING                0 /* Linux, more than one core: pin each core to its own host CPU */
 #define configTICK_TYPE_WIDTH_IN_BITS               TICK_TYPE_WIDTH_32_BITS
 #define configIDLE_SHOULD_YIELD                     1
 #define configUSE_TASK_NOTIFICATIONS                1
@@ -68,21 +76,25 @@ extern "C" {
 #define configUSE_TIME_SLICING                      0
 #define configUSE_NEWLIB_REENTRANT                  0
 #define configENABLE_BACKWARD_COMPATIBILITY         1
-#define configNUM_THREAD_LOCAL_STORAGE_POINTERS     4
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS     4 /* the last one holds the values of the C++ thread specific keys */
+#define configPOSIX_GTHREAD_KEYS                    16 /* number of keys for C++ thread specific storage (__gthread_key_create()) */
 #define configUSE_APPLICATION_TASK_TAG              0
 
 /* Tasks.c additions (e.g. Thread Aware Debug capability) */
-#define configINCLUDE_FREERTOS_TASK_C_ADDITIONS_H   0
+#define configINCLUDE_FREERTOS_TASK_C_ADDITIONS_H   1 /* freertos_tasks_c_additions.h, priority inheritance of the std::mutex shim */
 
 /* Memory allocation related definitions. */
 #define configSUPPORT_STATIC_ALLOCATION             1
 #define configSUPPORT_DYNAMIC_ALLOCATION            1
 #define configAPPLICATION_ALLOCATED_HEAP            0
+#define configPOSIX_HEAP                            0 /* 0: host malloc, keeps ASan / valgrind checks, 1: size class pools (see portable/utils/heap_pool.h), 2: bounded arena (see portable/utils/heap_arena.h) */
+#define configTOTAL_HEAP_SIZE                       ( ( size_t ) ( 512 * 1024 ) ) /* arena size with configPOSIX_HEAP == 2 */
 
 /* Hook function related definitions. */
 #define configUSE_IDLE_HOOK                         0
 #define configUSE_TICK_HOOK                         0
 #define configCHECK_FOR_STACK_OVERFLOW              2
+#define configPOSIX_ERROR_POLICY                    0 /* on assert / error: 0: print every two seconds, 1: abort(), 2: _exit() with the error code, 3: call vApplicationErrorHook() */
 #define configUSE_MALLOC_FAILED_HOOK                0
 #define configUSE_DAEMON_TASK_STARTUP_HOOK          0
 
@@ -90,6 +102,9 @@ extern "C" {
 #define configGENERATE_RUN_TIME_STATS               1
 #define configUSE_TRACE_FACILITY                    1
 #define configUSE_STATS_FORMATTING_FUNCTIONS        0
+#define configUSE_POSIX_TRACE_RECORDER              0 /* see portable/utils/trace_recorder.h */
+#define configUSE_POSIX_SCHED_REPLAY                0 /* see portable/utils/sched_replay.h */
+#define configUSE_POSIX_PROFILER                    0 /* see portable/utils/profiler.h */
 
 /* Task aware debugging. */
 #define configRECORD_STACK_HIGH_ADDRESS             1
@@ -185,4 +200,8 @@ PRIORITY THAN THIS! (higher priorities are lower numeric values. */
 #include "freertos_config_override.h"
 #endif
 
+#if configUSE_POSIX_TRACE_RECORDER == 1
+#include "portable/utils/trace_recorder.h"
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2026 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Additions to tasks.c for the posix port, included at the end of tasks.c
+ * with configINCLUDE_FREERTOS_TASK_C_ADDITIONS_H == 1.
+ */
+
+#ifndef FREERTOS_TASKS_C_ADDITIONS_H_
+#define FREERTOS_TASKS_C_ADDITIONS_H_
+
+#if ( configUSE_MUTEXES == 1 )
+
+/*
+ * The locks behind std::mutex and std::shared_mutex (lib/cpp) aren't
+ * FreeRTOS mutexes, a task that waits for one lends the holder its
+ * priority with xTaskPriorityInherit(). While it does, the lock is counted
+ * in the mutexes held by the holder, so the holder keeps an inherited
+ * priority until it released the last lock it may come from, and
+ * vTaskPriorityDisinheritAfterTimeout() works as for a FreeRTOS mutex. The
+ * holder drops the count with xTaskPriorityDisinherit() when it releases
+ * the lock. Must be called in a critical section.
+ */
+void vTaskAddMutexHeld( void * pvMutexHolder )
+{
+    TCB_t * const pxTCB = ( TCB_t * ) pvMutexHolder;
+
+    configASSERT( pxTCB );
+    ( pxTCB->uxMutexesHeld )++;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_MUTEXES */
+
+#endif /* FREERTOS_TASKS_C_ADDITIONS_H_ */
@@ -50,16 +50,25 @@
 * stdio (printf() and friends) should be called from a single task
 * only or serialized with a FreeRTOS primitive such as a binary
 * semaphore or mutex.
+*
+* With configNUMBER_OF_CORES > 1 the threads of up to that many tasks run
+* in parallel, one per simulated core. A thread learns its core when it is
+* resumed. The kernel's critical sections take two recursive spinlocks
+* (the task and the ISR lock), another core is asked to reschedule with
+* SIG_YIELD sent to the thread of its current task. The tick is raised on
+* the task of core 0. vTaskEndScheduler() is not supported then.
+* With configUSE_POSIX_CORE_PINNING each core gets its own host CPU and a
+* thread is pinned to it when it runs there, so tasks bound to a core with
+* vTaskCoreAffinitySet() don't migrate between host CPUs.
 *----------------------------------------------------------*/
-#include "portable/portmacro.h"
-
-#ifdef __linux__
-    #define __USE_GNU
+#if defined( __linux__ ) && !defined( _GNU_SOURCE )
+    #define _GNU_SOURCE
 #endif
 
 #include <errno.h>
 #include <pthread.h>
 #include <limits.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -68,19 +77,35 @@
 #include <sys/times.h>
 #include <time.h>
 #include <unistd.h>
+#include <unwind.h>
 
 #ifdef __APPLE__
     #include <mach/mach_vm.h>
 #endif
 
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+
 /* Scheduler includes. */
 #include "FreeRTOS.h"
 #include "task.h"
 #include "timers.h"
 #include "utils/wait_for_event.h"
+
+#if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+    #include "utils/sched_replay.h"
+#endif
+#if ( configUSE_POSIX_PROFILER == 1 )
+    #include "utils/profiler.h"
+#endif
 /*-----------------------------------------------------------*/
 
-#define SIG_RESUME    SIGUSR1
+#define SIG_RESUME       SIGUSR1
+#define SIG_BACKTRACE    SIGUSR2
+#define SIG_YIELD        SIGURG
+
+#define portSPIN_YIELD_COUNT    ( 100U ) /* attempts to take a lock before sched_yield() */
 
 typedef struct THREAD
 {
@@ -89,6 +114,18 @@ typedef struct THREAD
     void * pvParams;
     BaseType_t xDying;
     struct event * ev;
+    uint8_t * pucHostStack; /* lowest usable address of the pthread stack, NULL if unknown */
+    size_t xHostStackSize;
+    #if ( configNUMBER_OF_CORES > 1 )
+        BaseType_t xCoreID; /* core to run on, set by the thread that resumes it */
+    #endif
+    #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        uint32_t ulNumber; /* creation order, stable between runs */
+    #endif
+    #if ( configUSE_POSIX_PROFILER == 1 )
+        BaseType_t xProfiled;
+        timer_t xProfilerTimer;
+    #endif
 } Thread_t;
 
 /*
@@ -108,23 +145,149 @@ static pthread_once_t hSigSetupThread = PTHREAD_ONCE_INIT;
 static sigset_t xAllSignals;
 static sigset_t xSchedulerOriginalSignalMask;
 static pthread_t hMainThread = ( pthread_t ) NULL;
-static volatile BaseType_t uxCriticalNesting;
+#if ( configNUMBER_OF_CORES == 1 )
+    static volatile BaseType_t uxCriticalNesting;
+#endif
 static BaseType_t xSchedulerEnd = pdFALSE;
+static uint64_t prvStartTimeNs;
+
 static pthread_t hTimerTickThread;
 static bool xTimerTickThreadShouldRun;
-static uint64_t prvStartTimeNs;
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+    static struct event * xVirtualTimeEvent;
+    static uint64_t ullVirtualTimeUs;
+#endif
+
+#define portBACKTRACE_MAX_FRAMES    ( 64U ) /* frames taken from another thread */
+
+/* Backtrace request to another thread, see uxPortGetTaskBacktrace(). The
+ * mutex is held for the whole request, a thread is marked dying under it. */
+enum
+{
+    eBacktraceIDLE = 0,
+    eBacktraceREQUESTED,
+    eBacktraceRUNNING,
+    eBacktraceDONE,
+    eBacktraceABANDONED /* the requester gave up, the handler still runs */
+};
+static pthread_mutex_t xBacktraceMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t xBacktraceThread;
+static void * pvBacktraceFrames[ portBACKTRACE_MAX_FRAMES ];
+static UBaseType_t uxBacktraceMaxFrames;
+static UBaseType_t uxBacktraceFrames;
+static int iBacktraceState = eBacktraceIDLE;
+
+#if ( configNUMBER_OF_CORES > 1 )
+    __thread volatile BaseType_t xPortCoreID;
+    __thread volatile UBaseType_t uxPortCriticalNesting;
+
+    /* Task and ISR lock, see vPortRecursiveLockGet(). */
+    typedef struct RECURSIVE_LOCK
+    {
+        uintptr_t uxOwner; /* pthread_self() of the owner, 0 if free */
+        UBaseType_t uxCount;
+    } RecursiveLock_t;
+
+    static RecursiveLock_t xRecursiveLocks[ 2 ];
+#endif
+/*-----------------------------------------------------------*/
+
+#ifndef configPOSIX_TIME_CLOCK
+    #define configPOSIX_TIME_CLOCK    CLOCK_MONOTONIC
+#endif
+
+#ifndef configUSE_POSIX_CORE_PINNING
+    #define configUSE_POSIX_CORE_PINNING    0
+#endif
+
+#if ( configUSE_POSIX_CORE_PINNING == 1 )
+    #if ( configNUMBER_OF_CORES == 1 ) || !defined( __linux__ )
+        #error "configUSE_POSIX_CORE_PINNING requires configNUMBER_OF_CORES > 1 and Linux"
+    #endif
+
+    static int iCoreHostCPU[ configNUMBER_OF_CORES ]; /* -1 if the core isn't pinned */
+    static __thread BaseType_t xPinnedCoreID = -1;    /* core the calling thread is pinned for */
+#endif
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 ) && ( INCLUDE_xTaskGetIdleTaskHandle == 1 )
+    #define portCORE_USAGE    1
+
+    /* Host time each core spent with other tasks than the idle tasks, see
+     * vPortGetCoreUsage(). Only the thread running on a core writes it. */
+    typedef struct CORE_USAGE
+    {
+        uint64_t ullBusyNs;
+        uint64_t ullSwitchNs; /* last switch on this core */
+        BaseType_t xIdle;
+    } CoreUsage_t;
+
+    static CoreUsage_t xCoreUsage[ configNUMBER_OF_CORES ];
+    static uint64_t ullCoreUsageStartNs;
+#else
+    #define portCORE_USAGE    0
+#endif
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+    #if ( configUSE_TICKLESS_IDLE != 1 )
+        #error "configUSE_POSIX_VIRTUAL_TIME requires configUSE_TICKLESS_IDLE"
+    #endif
+    #if ( INCLUDE_xTaskGetIdleTaskHandle != 1 ) || ( INCLUDE_xTaskGetSchedulerState != 1 )
+        #error "configUSE_POSIX_VIRTUAL_TIME requires INCLUDE_xTaskGetIdleTaskHandle and INCLUDE_xTaskGetSchedulerState"
+    #endif
+#endif
+
+#if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+    #if ( INCLUDE_xTaskGetIdleTaskHandle != 1 ) || ( INCLUDE_xTaskGetSchedulerState != 1 )
+        #error "configUSE_POSIX_SCHED_REPLAY requires INCLUDE_xTaskGetIdleTaskHandle and INCLUDE_xTaskGetSchedulerState"
+    #endif
+#endif
+
+#if ( configNUMBER_OF_CORES > 1 )
+    /* vPortSleep() would keep the scheduler suspended, i.e. the task lock
+     * taken, while it sleeps. Virtual time and replay assume one running task. */
+    #if ( configUSE_TICKLESS_IDLE != 0 )
+        #error "configNUMBER_OF_CORES > 1 requires configUSE_TICKLESS_IDLE == 0"
+    #endif
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 ) || ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        #error "configUSE_POSIX_VIRTUAL_TIME and configUSE_POSIX_SCHED_REPLAY are single core only"
+    #endif
+#endif
 /*-----------------------------------------------------------*/
 
 static void prvSetupSignalsAndSchedulerPolicy( void );
 static void prvSetupTimerInterrupt( void );
 static void * prvWaitForStart( void * pvParams );
+static void prvPaintHostStack( Thread_t * pxThread );
 static void prvSwitchThread( Thread_t * xThreadToResume,
                              Thread_t * xThreadToSuspend );
 static void prvSuspendSelf( Thread_t * thread );
 static void prvResumeThread( Thread_t * xThreadId );
 static void vPortSystemTickHandler( int sig );
+static void prvBacktraceHandler( int sig );
+#if ( configNUMBER_OF_CORES > 1 )
+    static void prvYieldHandler( int sig );
+    static void prvEnterCore( BaseType_t xCoreID );
+#endif
+#if ( configUSE_POSIX_CORE_PINNING == 1 )
+    static void prvMapCoresToHostCPUs( void );
+#endif
 static void vPortStartFirstTask( void );
+static uint64_t prvGetTimeNs( void );
+#if ( portCORE_USAGE == 1 )
+    static void prvCoreUsageSwitch( BaseType_t xCoreID,
+                                    const Thread_t * pxThreadToResume );
+#endif
 static void prvPortYieldFromISR( void );
+#if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+    static uint32_t prvSchedReplayTaskNumber( void );
+    void vPortSchedReplayPoint( void );
+#endif
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+    static BaseType_t prvVirtualTimeCanAdvance( void );
+    static void prvVirtualTimeTick( void );
+    static void prvVirtualTimeRaiseTick( void );
+#endif
 /*-----------------------------------------------------------*/
 
 static void prvFatalError( const char * pcCall,
@@ -179,8 +342,16 @@ StackType_t * pxPortInitialiseStack( StackType_t * pxTopOfStack,
     thread->pvParams = pvParameters;
     thread->xDying = pdFALSE;
 
+    #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+    {
+        static uint32_t ulThreadsCreated = 0;
+
+        thread->ulNumber = ++ulThreadsCreated;
+    }
+    #endif
+
     /* Ensure ulStackSize is at least PTHREAD_STACK_MIN */
-    ulStackSize = (ulStackSize < PTHREAD_STACK_MIN) ? PTHREAD_STACK_MIN : ulStackSize;
+    ulStackSize = (ulStackSize < ( size_t ) PTHREAD_STACK_MIN) ? ( size_t ) PTHREAD_STACK_MIN : ulStackSize;
 
     pthread_attr_init( &xThreadAttributes );
     iRet = pthread_attr_setstacksize( &xThreadAttributes, ulStackSize );
@@ -192,7 +363,7 @@ StackType_t * pxPortInitialiseStack( StackType_t * pxTopOfStack,
 
     thread->ev = event_create();
 
-    vPortEnterCritical();
+    portENTER_CRITICAL();
 
     iRet = pthread_create( &thread->pthread, &xThreadAttributes,
                            prvWaitForStart, thread );
@@ -202,7 +373,7 @@ StackType_t * pxPortInitialiseStack( StackType_t * pxTopOfStack,
         prvFatalError( "pthread_create", iRet );
     }
 
-    vPortExitCritical();
+    portEXIT_CRITICAL();
 
     return pxTopOfStack;
 }
@@ -210,10 +381,39 @@ StackType_t * pxPortInitialiseStack( StackType_t * pxTopOfStack,
 
 void vPortStartFirstTask( void )
 {
-    Thread_t * pxFirstThread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+    #if ( portCORE_USAGE == 1 )
+        ullCoreUsageStartNs = prvGetTimeNs();
+        memset( xCoreUsage, 0, sizeof( xCoreUsage ) );
+    #endif
 
-    /* Start the first task. */
-    prvResumeThread( pxFirstThread );
+    #if ( configNUMBER_OF_CORES > 1 )
+        BaseType_t xCoreID;
+
+        /* Start the first task of each core. */
+        for( xCoreID = 0; xCoreID < configNUMBER_OF_CORES; xCoreID++ )
+        {
+            Thread_t * pxFirstThread = prvGetThreadFromTask( xTaskGetCurrentTaskHandleForCore( xCoreID ) );
+
+            pxFirstThread->xCoreID = xCoreID;
+            #if ( portCORE_USAGE == 1 )
+                prvCoreUsageSwitch( xCoreID, pxFirstThread );
+            #endif
+            prvResumeThread( pxFirstThread );
+        }
+    #else
+        Thread_t * pxFirstThread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+
+        #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+            prvVirtualTimeRaiseTick();
+        #endif
+
+        #if ( portCORE_USAGE == 1 )
+            prvCoreUsageSwitch( 0, pxFirstThread );
+        #endif
+
+        /* Start the first task. */
+        prvResumeThread( pxFirstThread );
+    #endif /* configNUMBER_OF_CORES */
 }
 /*-----------------------------------------------------------*/
 
@@ -251,7 +451,7 @@ BaseType_t xPortStartScheduler( void )
     }
     
     /* Cancel the Idle task and free its resources */
-    #if ( INCLUDE_xTaskGetIdleTaskHandle == 1 )
+    #if ( INCLUDE_xTaskGetIdleTaskHandle == 1 ) && ( configNUMBER_OF_CORES == 1 )
         vPortCancelThread( xTaskGetIdleTaskHandle() );
     #endif
 
@@ -286,9 +486,19 @@ void vPortEndScheduler( void )
 {
     Thread_t * pxCurrentThread;
 
+    /* Not supported with more than one core: the tasks on the other cores
+     * keep running while the kernel already considers itself stopped. */
+    configASSERT( configNUMBER_OF_CORES == 1 );
+
     /* Stop the timer tick thread. */
     xTimerTickThreadShouldRun = false;
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+        event_signal( xVirtualTimeEvent );
+    #endif
     pthread_join( hTimerTickThread, NULL );
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+        event_delete( xVirtualTimeEvent );
+    #endif
 
     /* Signal the scheduler to exit its loop. */
     xSchedulerEnd = pdTRUE;
@@ -296,11 +506,12 @@ void vPortEndScheduler( void )
 
     /* Waiting to be deleted here. */
     pxCurrentThread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
-    event_wait( pxCurrentThread->ev );
-    pthread_testcancel();
+    prvSuspendSelf( pxCurrentThread );
 }
 /*-----------------------------------------------------------*/
 
+#if ( configNUMBER_OF_CORES == 1 )
+
 void vPortEnterCritical( void )
 {
     if( uxCriticalNesting == 0 )
@@ -349,194 +560,1142 @@ void vPortYield( void )
 }
 /*-----------------------------------------------------------*/
 
-void vPortDisableInterrupts( void )
+#else /* configNUMBER_OF_CORES */
+
+/*
+ * Called with signals blocked and outside of critical sections, the kernel
+ * takes the locks in vTaskSwitchContext(). Only the thread running on a
+ * core switches its task, so pxCurrentTCBs[ xCoreID ] can be read without
+ * the locks afterwards.
+ */
+static void prvPortYieldFromISR( void )
 {
-    pthread_sigmask( SIG_BLOCK, &xAllSignals, NULL );
+    const BaseType_t xCoreID = portGET_CORE_ID();
+    Thread_t * xThreadToSuspend;
+    Thread_t * xThreadToResume;
+
+    xThreadToSuspend = prvGetThreadFromTask( xTaskGetCurrentTaskHandleForCore( xCoreID ) );
+
+    vTaskSwitchContext( xCoreID );
+
+    xThreadToResume = prvGetThreadFromTask( xTaskGetCurrentTaskHandleForCore( xCoreID ) );
+
+    prvSwitchThread( xThreadToResume, xThreadToSuspend );
 }
 /*-----------------------------------------------------------*/
 
-void vPortEnableInterrupts( void )
+void vPortYield( void )
 {
-    pthread_sigmask( SIG_UNBLOCK, &xAllSignals, NULL );
+    const UBaseType_t uxMask = xPortSetInterruptMask();
+
+    prvPortYieldFromISR();
+
+    vPortClearInterruptMask( uxMask );
 }
 /*-----------------------------------------------------------*/
 
-UBaseType_t xPortSetInterruptMask( void )
+void vPortYieldCore( BaseType_t xCoreID )
 {
-    /* Interrupts are always disabled inside ISRs (signals
-     * handlers). */
-    return ( UBaseType_t ) 0;
+    TaskHandle_t xTask = xTaskGetCurrentTaskHandleForCore( xCoreID );
+
+    /* Called with the ISR lock taken, so the task stays current on that
+     * core. A thread that has just been switched out handles the signal
+     * when it runs the next time, it only causes an extra reschedule. */
+    if( xTask != NULL )
+    {
+        ( void ) pthread_kill( prvGetThreadFromTask( xTask )->pthread, SIG_YIELD );
+    }
 }
 /*-----------------------------------------------------------*/
 
-void vPortClearInterruptMask( UBaseType_t uxMask )
+/*
+ * Runs on the thread of the current task of the core that is asked to
+ * reschedule, with all signals blocked like the tick handler. A thread in
+ * a critical section handles it as soon as it unblocks the signals, which
+ * prvCheckForRunStateChange() in tasks.c relies on.
+ */
+static void prvYieldHandler( int sig )
 {
-    ( void ) uxMask;
+    ( void ) sig;
+
+    prvPortYieldFromISR();
 }
 /*-----------------------------------------------------------*/
 
-static uint64_t prvGetTimeNs( void )
+/*
+ * Called by a thread that was resumed to run on xCoreID. With pinning, the
+ * host affinity only changes when the task moved to another core.
+ */
+static void prvEnterCore( BaseType_t xCoreID )
 {
-    struct timespec t;
+    xPortCoreID = xCoreID;
 
-    clock_gettime( CLOCK_MONOTONIC, &t );
+    #if ( configUSE_POSIX_CORE_PINNING == 1 )
+        if( ( xPinnedCoreID != xCoreID ) && ( iCoreHostCPU[ xCoreID ] >= 0 ) )
+        {
+            cpu_set_t xSet;
 
-    return ( uint64_t ) t.tv_sec * ( uint64_t ) 1000000000UL + ( uint64_t ) t.tv_nsec;
+            CPU_ZERO( &xSet );
+            CPU_SET( iCoreHostCPU[ xCoreID ], &xSet );
+
+            if( pthread_setaffinity_np( pthread_self(), sizeof( xSet ), &xSet ) == 0 )
+            {
+                xPinnedCoreID = xCoreID;
+            }
+        }
+    #endif
 }
 /*-----------------------------------------------------------*/
 
-/* commented as part of the code below in vPortSystemTickHandler,
- * to adjust timing according to full demo requirements */
-/* static uint64_t prvTickCount; */
+#if ( configUSE_POSIX_CORE_PINNING == 1 )
 
-static void * prvTimerTickHandler( void * arg )
+/*
+ * Core n is pinned to the n-th host CPU the process may run on. With more
+ * cores than CPUs, they are shared round robin.
+ */
+static void prvMapCoresToHostCPUs( void )
 {
-    ( void ) arg;
-    
-    prvPortSetCurrentThreadName("Scheduler timer");
+    cpu_set_t xSet;
+    BaseType_t xCoreID = 0;
+    BaseType_t xCPUs;
+    int iCPU;
 
-    while( xTimerTickThreadShouldRun )
+    if( sched_getaffinity( 0, sizeof( xSet ), &xSet ) == 0 )
     {
-        /*
-         * signal to the active task to cause tick handling or
-         * preemption (if enabled)
-         */
-        Thread_t * thread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
-        pthread_kill( thread->pthread, SIGALRM );
-        usleep( portTICK_RATE_MICROSECONDS );
+        for( iCPU = 0; ( iCPU < CPU_SETSIZE ) && ( xCoreID < configNUMBER_OF_CORES ); iCPU++ )
+        {
+            if( CPU_ISSET( iCPU, &xSet ) )
+            {
+                iCoreHostCPU[ xCoreID++ ] = iCPU;
+            }
+        }
     }
 
-    return NULL;
+    xCPUs = xCoreID;
+
+    for( ; xCoreID < configNUMBER_OF_CORES; xCoreID++ )
+    {
+        iCoreHostCPU[ xCoreID ] = ( xCPUs > 0 ) ? iCoreHostCPU[ xCoreID % xCPUs ] : -1;
+    }
 }
+
+#endif /* configUSE_POSIX_CORE_PINNING */
 /*-----------------------------------------------------------*/
 
-/*
- * Setup the systick timer to generate the tick interrupts at the required
- * frequency.
- */
-void prvSetupTimerInterrupt( void )
+int iPortGetCoreHostCPU( BaseType_t xCoreID )
 {
-    xTimerTickThreadShouldRun = true;
-    pthread_create( &hTimerTickThread, NULL, prvTimerTickHandler, NULL );
+    #if ( configUSE_POSIX_CORE_PINNING == 1 )
+        return iCoreHostCPU[ xCoreID ];
+    #else
+        ( void ) xCoreID;
 
-    prvStartTimeNs = prvGetTimeNs();
+        return -1;
+    #endif
 }
 /*-----------------------------------------------------------*/
 
-static void vPortSystemTickHandler( int sig )
+void vPortWaitForInterrupt( void )
 {
-    Thread_t * pxThreadToSuspend;
-    Thread_t * pxThreadToResume;
-
-    ( void ) sig;
+    sigset_t xMask;
 
-    uxCriticalNesting++; /* Signals are blocked in this signal handler. */
+    /* Block first, so a request that arrives meanwhile stays pending and
+     * ends the wait at once. */
+    pthread_sigmask( SIG_BLOCK, &xAllSignals, &xMask );
+    sigsuspend( &xMask );
+    pthread_sigmask( SIG_SETMASK, &xMask, NULL );
+}
+/*-----------------------------------------------------------*/
 
-    #if ( configUSE_PREEMPTION == 1 )
-        pxThreadToSuspend = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
-    #endif
+/*
+ * The owner is a thread, not a core, so host threads calling the API don't
+ * share the locks with the task of core 0. The kernel takes a lock and
+ * gives it back on the same thread, a task doesn't switch while it holds one.
+ */
+void vPortRecursiveLockGet( BaseType_t xLockNum )
+{
+    RecursiveLock_t * pxLock = &xRecursiveLocks[ xLockNum ];
+    const uintptr_t uxSelf = ( uintptr_t ) pthread_self();
+    uintptr_t uxFree;
+    uint32_t ulSpins = 0U;
 
-    /* Tick Increment, accounting for any lost signals or drift in
-     * the timer. */
-    xTaskIncrementTick();
+    if( __atomic_load_n( &pxLock->uxOwner, __ATOMIC_RELAXED ) == uxSelf )
+    {
+        pxLock->uxCount++;
+        return;
+    }
 
-    #if ( configUSE_PREEMPTION == 1 )
-        /* Select Next Task. */
-        vTaskSwitchContext();
+    for( ; ; )
+    {
+        uxFree = 0U;
 
-        pxThreadToResume = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+        if( ( __atomic_load_n( &pxLock->uxOwner, __ATOMIC_RELAXED ) == 0U ) &&
+            __atomic_compare_exchange_n( &pxLock->uxOwner, &uxFree, uxSelf, pdFALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            break;
+        }
 
-        prvSwitchThread( pxThreadToResume, pxThreadToSuspend );
-    #endif
+        /* The host may have preempted the owner, give it the CPU. */
+        if( ++ulSpins >= portSPIN_YIELD_COUNT )
+        {
+            ulSpins = 0U;
+            sched_yield();
+        }
+    }
 
-    uxCriticalNesting--;
+    pxLock->uxCount = 1U;
 }
 /*-----------------------------------------------------------*/
 
-void vPortThreadDying( void * pxTaskToDelete,
-                       volatile BaseType_t * pxPendYield )
+void vPortRecursiveLockRelease( BaseType_t xLockNum )
 {
-    Thread_t * pxThread = prvGetThreadFromTask( pxTaskToDelete );
+    RecursiveLock_t * pxLock = &xRecursiveLocks[ xLockNum ];
 
-    ( void ) pxPendYield;
+    configASSERT( __atomic_load_n( &pxLock->uxOwner, __ATOMIC_RELAXED ) == ( uintptr_t ) pthread_self() );
 
-    pxThread->xDying = pdTRUE;
+    if( --pxLock->uxCount == 0U )
+    {
+        __atomic_store_n( &pxLock->uxOwner, 0U, __ATOMIC_RELEASE );
+    }
 }
 /*-----------------------------------------------------------*/
 
-void vPortCancelThread( void * pxTaskToDelete )
-{
-    Thread_t * pxThreadToCancel = prvGetThreadFromTask( pxTaskToDelete );
+#endif /* configNUMBER_OF_CORES */
 
-    /*
-     * The thread has already been suspended so it can be safely cancelled.
-     */
-    pthread_cancel( pxThreadToCancel->pthread );
-    event_signal( pxThreadToCancel->ev );
-    pthread_join( pxThreadToCancel->pthread, NULL );
-    event_delete( pxThreadToCancel->ev );
+void vPortDisableInterrupts( void )
+{
+    pthread_sigmask( SIG_BLOCK, &xAllSignals, NULL );
 }
 /*-----------------------------------------------------------*/
 
-static void * prvWaitForStart( void * pvParams )
+void vPortEnableInterrupts( void )
 {
-    Thread_t * pxThread = pvParams;
-
-    prvSuspendSelf( pxThread );
-
-    /* Resumed for the first time, unblocks all signals. */
-    uxCriticalNesting = 0;
-    vPortEnableInterrupts();
+    #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        vPortSchedReplayPoint();
+    #endif
 
-    /* Set thread name */
-    prvPortSetCurrentThreadName(pcTaskGetName(xTaskGetCurrentTaskHandle()));
+    pthread_sigmask( SIG_UNBLOCK, &xAllSignals, NULL );
+}
+/*-----------------------------------------------------------*/
 
-    /* Call the task's entry point. */
-    pxThread->pxCode( pxThread->pvParams );
+BaseType_t xPortInterruptsDisabled( void )
+{
+    sigset_t xMask;
 
-    /* A function that implements a task must not exit or attempt to return to
-     * its caller as there is nothing to return to. If a task wants to exit it
-     * should instead call vTaskDelete( NULL ). Artificially force an assert()
-     * to be triggered if configASSERT() is defined, so application writers can
-     * catch the error. */
-    configASSERT( pdFALSE );
+    /* Blocked in critical sections and in the tick handler, also by host
+     * threads that aren't tasks. */
+    pthread_sigmask( SIG_SETMASK, NULL, &xMask );
 
-    return NULL;
+    return ( sigismember( &xMask, SIGALRM ) == 1 ) ? pdTRUE : pdFALSE;
 }
 /*-----------------------------------------------------------*/
 
-static void prvSwitchThread( Thread_t * pxThreadToResume,
-                             Thread_t * pxThreadToSuspend )
+BaseType_t xPortIsTaskThread( void )
 {
-    BaseType_t uxSavedCriticalNesting;
+    TaskHandle_t xTask = xTaskGetCurrentTaskHandle();
 
-    if( pxThreadToSuspend != pxThreadToResume )
-    {
-        /*
-         * Switch tasks.
-         *
-         * The critical section nesting is per-task, so save it on the
-         * stack of the current (suspending thread), restoring it when
-         * we switch back to this task.
-         */
-        uxSavedCriticalNesting = uxCriticalNesting;
+    return ( ( xTask != NULL ) && ( pthread_equal( prvGetThreadFromTask( xTask )->pthread, pthread_self() ) != 0 ) ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
 
-        prvResumeThread( pxThreadToResume );
+UBaseType_t xPortSetInterruptMask( void )
+{
+    #if ( configNUMBER_OF_CORES > 1 )
+        sigset_t xPrevious;
+
+        /* Also called from tasks, the ISR lock must not be taken with
+         * the tick enabled. */
+        pthread_sigmask( SIG_BLOCK, &xAllSignals, &xPrevious );
+
+        return ( sigismember( &xPrevious, SIGALRM ) == 1 ) ? ( UBaseType_t ) 1 : ( UBaseType_t ) 0;
+    #else
+        /* Interrupts are always disabled inside ISRs (signals
+         * handlers). */
+        return ( UBaseType_t ) 0;
+    #endif
+}
+/*-----------------------------------------------------------*/
 
-        if( pxThreadToSuspend->xDying == pdTRUE )
+void vPortClearInterruptMask( UBaseType_t uxMask )
+{
+    #if ( configNUMBER_OF_CORES > 1 )
+        if( uxMask == 0U )
         {
-            pthread_exit( NULL );
+            vPortEnableInterrupts();
         }
+    #else
+        ( void ) uxMask;
+    #endif
+}
+/*-----------------------------------------------------------*/
 
-        prvSuspendSelf( pxThreadToSuspend );
+static uint64_t prvGetTimeNs( void )
+{
+    struct timespec t;
 
-        uxCriticalNesting = uxSavedCriticalNesting;
-    }
+    clock_gettime( CLOCK_MONOTONIC, &t );
+
+    return ( uint64_t ) t.tv_sec * ( uint64_t ) 1000000000UL + ( uint64_t ) t.tv_nsec;
+}
+/*-----------------------------------------------------------*/
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 0 )
+
+/*
+ * Host time behind ullPortGetTimeNs(). Same epoch as prvGetTimeNs(), a
+ * coarse clock only lags by up to one host jiffy, so the tick thread can
+ * keep its deadlines on the precise clock.
+ */
+static uint64_t prvGetClockNs( void )
+{
+    struct timespec t;
+
+    clock_gettime( configPOSIX_TIME_CLOCK, &t );
+
+    return ( uint64_t ) t.tv_sec * ( uint64_t ) 1000000000UL + ( uint64_t ) t.tv_nsec;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Time scaling. The tick thread waits ulTickPeriodUs between two ticks,
+ * application time runs portTICK_RATE_MICROSECONDS / ulTickPeriodUs times
+ * faster than host time. Each change of the period starts a new segment at
+ * the current time, so the scaled time stays continuous. The parameters
+ * are read from tasks, host threads and the tick handler, a sequence count
+ * (odd while a change is in progress) keeps them consistent without a lock.
+ */
+static uint32_t ulTimeScaleSeq;
+static uint32_t ulTickPeriodUs = portTICK_RATE_MICROSECONDS;
+static uint64_t ullScaleHostNs;
+static uint64_t ullScaleTimeNs;
+
+static uint64_t prvScaleTimeNs( uint64_t ullHostNs,
+                                uint64_t ullBaseHostNs,
+                                uint64_t ullBaseTimeNs,
+                                uint32_t ulPeriodUs )
+{
+    const uint64_t ullPeriodNs = ( uint64_t ) ulPeriodUs * 1000ULL;
+    const uint64_t ullTickNs = ( uint64_t ) portTICK_RATE_MICROSECONDS * 1000ULL;
+    const uint64_t ullElapsedNs = ullHostNs - ullBaseHostNs;
+
+    if( ulPeriodUs == portTICK_RATE_MICROSECONDS )
+    {
+        /* Real time, no divisions needed. */
+        return ullBaseTimeNs + ullElapsedNs;
+    }
+
+    /* Split into whole periods and remainder to avoid an overflow. */
+    return ullBaseTimeNs + ( ullElapsedNs / ullPeriodNs ) * ullTickNs + ( ullElapsedNs % ullPeriodNs ) * ullTickNs / ullPeriodNs;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullPortGetTimeNs( void )
+{
+    uint32_t ulSeq;
+    uint32_t ulPeriodUs;
+    uint64_t ullBaseHostNs;
+    uint64_t ullBaseTimeNs;
+    uint64_t ullHostNs;
+
+    do
+    {
+        ulSeq = __atomic_load_n( &ulTimeScaleSeq, __ATOMIC_ACQUIRE );
+        ulPeriodUs = __atomic_load_n( &ulTickPeriodUs, __ATOMIC_RELAXED );
+        ullBaseHostNs = __atomic_load_n( &ullScaleHostNs, __ATOMIC_RELAXED );
+        ullBaseTimeNs = __atomic_load_n( &ullScaleTimeNs, __ATOMIC_RELAXED );
+        ullHostNs = prvGetClockNs();
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    } while( ( ( ulSeq & 1U ) != 0U ) || ( __atomic_load_n( &ulTimeScaleSeq, __ATOMIC_RELAXED ) != ulSeq ) );
+
+    return prvScaleTimeNs( ullHostNs, ullBaseHostNs, ullBaseTimeNs, ulPeriodUs );
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulPortGetTickPeriodUs( void )
+{
+    return __atomic_load_n( &ulTickPeriodUs, __ATOMIC_RELAXED );
+}
+/*-----------------------------------------------------------*/
+
+void vPortSetTickPeriodUs( uint32_t ulPeriodUs )
+{
+    uint32_t ulSeq;
+    uint64_t ullHostNs;
+
+    configASSERT( ulPeriodUs > 0 );
+
+    /* Take the sequence count to an odd value, this also serialises
+     * concurrent changes. */
+    do
+    {
+        ulSeq = __atomic_load_n( &ulTimeScaleSeq, __ATOMIC_RELAXED ) & ~1U;
+    } while( __atomic_compare_exchange_n( &ulTimeScaleSeq, &ulSeq, ulSeq + 1U, pdFALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) == 0 );
+
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    ullHostNs = prvGetClockNs();
+    __atomic_store_n( &ullScaleTimeNs, prvScaleTimeNs( ullHostNs, ullScaleHostNs, ullScaleTimeNs, ulTickPeriodUs ), __ATOMIC_RELAXED );
+    __atomic_store_n( &ullScaleHostNs, ullHostNs, __ATOMIC_RELAXED );
+    __atomic_store_n( &ulTickPeriodUs, ulPeriodUs, __ATOMIC_RELAXED );
+
+    __atomic_store_n( &ulTimeScaleSeq, ulSeq + 2U, __ATOMIC_RELEASE );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_VIRTUAL_TIME */
+
+/* commented as part of the code below in vPortSystemTickHandler,
+ * to adjust timing according to full demo requirements */
+/* static uint64_t prvTickCount; */
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 0 )
+
+static void * prvTimerTickHandler( void * arg )
+{
+    #if ( configUSE_POSIX_SCHED_REPLAY == 0 )
+        uint64_t ullNextTickNs = prvGetTimeNs();
+    #endif
+
+    ( void ) arg;
+    
+    prvPortSetCurrentThreadName("Scheduler timer");
+
+    while( xTimerTickThreadShouldRun )
+    {
+        /*
+         * signal to the active task to cause tick handling or
+         * preemption (if enabled)
+         */
+        Thread_t * thread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+
+        #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+            /* Ticks come from the log while it is replayed. */
+            if( xSchedReplayIsReplaying() == pdFALSE )
+        #endif
+        {
+            pthread_kill( thread->pthread, SIGALRM );
+        }
+
+        #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        {
+            /* Keep a whole period between two ticks. Catching up with
+             * absolute deadlines raises ticks back to back when the host
+             * falls behind, and such a tick can hit a thread that is just
+             * being switched out. The recorded position of that tick can't
+             * be reproduced, so the replay diverged. */
+            usleep( ulPortGetTickPeriodUs() );
+        }
+        #else
+        {
+            /* Wait for absolute deadlines, so the tick count keeps pace with
+             * ullPortGetTimeNs(). If the host falls behind by more than a tick,
+             * the missed ticks are dropped (a pending SIGALRM is only raised
+             * once anyway). */
+            const uint64_t ullPeriodNs = ( uint64_t ) ulPortGetTickPeriodUs() * 1000ULL;
+            const uint64_t ullNowNs = prvGetTimeNs();
+
+            ullNextTickNs += ullPeriodNs;
+
+            if( ullNowNs > ullNextTickNs + ullPeriodNs )
+            {
+                ullNextTickNs = ullNowNs;
+            }
+            else
+            {
+                struct timespec xDeadline = { ( time_t ) ( ullNextTickNs / 1000000000ULL ), ( long ) ( ullNextTickNs % 1000000000ULL ) };
+
+                while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &xDeadline, NULL ) == EINTR )
+                {
+                }
+            }
+        }
+        #endif /* configUSE_POSIX_SCHED_REPLAY */
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+#else /* configUSE_POSIX_VIRTUAL_TIME */
+
+/*
+ * In virtual time mode the ticks are not paced by the host clock. The tick
+ * thread waits until a tick is requested and raises it on the idle task.
+ */
+static void * prvVirtualTimeTickHandler( void * arg )
+{
+    ( void ) arg;
+
+    prvPortSetCurrentThreadName("Scheduler timer");
+
+    while( xTimerTickThreadShouldRun )
+    {
+        event_wait( xVirtualTimeEvent );
+
+        if( xTimerTickThreadShouldRun )
+        {
+            Thread_t * thread = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+            pthread_kill( thread->pthread, SIGALRM );
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_VIRTUAL_TIME */
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+
+/*
+ * Time only passes while the idle task runs, i.e. all other tasks are
+ * blocked, and at least one of them waits for a timeout.
+ */
+static BaseType_t prvVirtualTimeCanAdvance( void )
+{
+    if( xTaskGetCurrentTaskHandle() != xTaskGetIdleTaskHandle() )
+    {
+        return pdFALSE;
+    }
+
+    /* The idle task is about to skip ticks in vPortSleep(), an additional
+     * tick would be pended and the jump would overshoot the next unblock
+     * time. The pended yield of xTaskResumeAll() raises the tick again. */
+    if( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+    {
+        return pdFALSE;
+    }
+
+    /* Only an interrupt can unblock a task, vPortSleep() waits for it
+     * in real time. */
+    return ( eTaskConfirmSleepModeStatus() != eNoTasksWaitingTimeout ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Called from the tick handler instead of xTaskIncrementTick().
+ */
+static void prvVirtualTimeTick( void )
+{
+    if( prvVirtualTimeCanAdvance() != pdFALSE )
+    {
+        __atomic_fetch_add( &ullVirtualTimeUs, portTICK_RATE_MICROSECONDS, __ATOMIC_RELAXED );
+        xTaskIncrementTick();
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Request a tick whenever the idle task is selected to run, including by
+ * the tick handler itself, so ticks follow each other for as long as the
+ * idle task keeps running. The request goes through the tick thread which
+ * gives the idle task the chance to skip idle periods of two or more
+ * ticks at once in vPortSleep().
+ */
+static void prvVirtualTimeRaiseTick( void )
+{
+    if( prvVirtualTimeCanAdvance() != pdFALSE )
+    {
+        event_signal( xVirtualTimeEvent );
+    }
+}
+/*-----------------------------------------------------------*/
+
+uint64_t ullPortGetVirtualTimeUs( void )
+{
+    return __atomic_load_n( &ullVirtualTimeUs, __ATOMIC_RELAXED );
+}
+/*-----------------------------------------------------------*/
+
+void vPortAdvanceVirtualTime( uint64_t ullTimeUs )
+{
+    __atomic_fetch_add( &ullVirtualTimeUs, ullTimeUs, __ATOMIC_RELAXED );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_VIRTUAL_TIME */
+
+#if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+
+static uint32_t prvSchedReplayTaskNumber( void )
+{
+    TaskHandle_t xTask = xTaskGetCurrentTaskHandle();
+
+    return ( xTask != NULL ) ? prvGetThreadFromTask( xTask )->ulNumber : 0;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Replay points are the places where the running task enables interrupts
+ * and where it suspends the scheduler (portMEMORY_BARRIER() right after
+ * the increment in vTaskSuspendAll()). A replayed tick is raised on the
+ * task's own thread and handled as soon as the signals are unblocked.
+ */
+void vPortSchedReplayPoint( void )
+{
+    TaskHandle_t xTask = xTaskGetCurrentTaskHandle();
+    BaseType_t xDue;
+
+    /* Host threads calling into FreeRTOS don't take part. */
+    if( ( xTask != NULL ) && ( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED ) &&
+        ( prvGetThreadFromTask( xTask )->pthread != pthread_self() ) )
+    {
+        return;
+    }
+
+    /* The idle task decides whether to suspend the scheduler by reading the
+     * tick count without a critical section, so the points it passes depend
+     * on where exactly the tick hit it. They aren't counted, a tick recorded
+     * on the idle task is due as soon as the idle task runs. */
+    if( ( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED ) && ( xTask == xTaskGetIdleTaskHandle() ) )
+    {
+        xDue = xSchedReplayTickDue( prvSchedReplayTaskNumber() );
+    }
+    else
+    {
+        xDue = xSchedReplayPoint( prvSchedReplayTaskNumber() );
+    }
+
+    if( xDue != pdFALSE )
+    {
+        pthread_kill( pthread_self(), SIGALRM );
+    }
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_SCHED_REPLAY */
+
+/*
+ * Setup the systick timer to generate the tick interrupts at the required
+ * frequency.
+ */
+void prvSetupTimerInterrupt( void )
+{
+    xTimerTickThreadShouldRun = true;
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+        xVirtualTimeEvent = event_create();
+        pthread_create( &hTimerTickThread, NULL, prvVirtualTimeTickHandler, NULL );
+    #else
+        pthread_create( &hTimerTickThread, NULL, prvTimerTickHandler, NULL );
+    #endif
+
+    prvStartTimeNs = prvGetTimeNs();
+}
+/*-----------------------------------------------------------*/
+
+#if ( configNUMBER_OF_CORES > 1 )
+
+static void vPortSystemTickHandler( int sig )
+{
+    UBaseType_t uxSavedInterruptStatus;
+    BaseType_t xSwitchRequired;
+
+    ( void ) sig;
+
+    traceISR_ENTER();
+
+    /* Other cores are asked to reschedule by xTaskIncrementTick(), without
+     * time slicing this one only switches if needed. */
+    uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+    xSwitchRequired = xTaskIncrementTick();
+    taskEXIT_CRITICAL_FROM_ISR( uxSavedInterruptStatus );
+
+    #if ( configUSE_PREEMPTION == 1 )
+        if( xSwitchRequired != pdFALSE )
+        {
+            traceISR_EXIT_TO_SCHEDULER();
+            prvPortYieldFromISR();
+        }
+        else
+    #else
+        ( void ) xSwitchRequired;
+    #endif
+    {
+        traceISR_EXIT();
+    }
+}
+/*-----------------------------------------------------------*/
+
+#else /* configNUMBER_OF_CORES */
+
+static void vPortSystemTickHandler( int sig )
+{
+    Thread_t * pxThreadToSuspend;
+    Thread_t * pxThreadToResume;
+
+    ( void ) sig;
+
+    uxCriticalNesting++; /* Signals are blocked in this signal handler. */
+
+    traceISR_ENTER();
+
+    #if ( configUSE_PREEMPTION == 1 )
+        pxThreadToSuspend = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+    #endif
+
+    /* Tick Increment, accounting for any lost signals or drift in
+     * the timer. */
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+        prvVirtualTimeTick();
+    #else
+        xTaskIncrementTick();
+    #endif
+
+    #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        vSchedReplayTick( prvSchedReplayTaskNumber() );
+    #endif
+
+    #if ( configUSE_PREEMPTION == 1 )
+        /* Select Next Task. */
+        vTaskSwitchContext();
+
+        pxThreadToResume = prvGetThreadFromTask( xTaskGetCurrentTaskHandle() );
+
+        if( pxThreadToResume != pxThreadToSuspend )
+        {
+            traceISR_EXIT_TO_SCHEDULER();
+        }
+        else
+        {
+            traceISR_EXIT();
+        }
+
+        prvSwitchThread( pxThreadToResume, pxThreadToSuspend );
+    #else
+        traceISR_EXIT();
+    #endif
+
+    #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+        /* The task that continues here returns from the signal handler
+         * without passing vPortEnableInterrupts(). */
+        if( xSchedReplayTickDue( prvSchedReplayTaskNumber() ) != pdFALSE )
+        {
+            pthread_kill( pthread_self(), SIGALRM );
+        }
+    #endif
+
+    uxCriticalNesting--;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configNUMBER_OF_CORES */
+
+void vPortThreadDying( void * pxTaskToDelete,
+                       volatile BaseType_t * pxPendYield )
+{
+    Thread_t * pxThread = prvGetThreadFromTask( pxTaskToDelete );
+
+    ( void ) pxPendYield;
+
+    /* Wait for a backtrace in progress, the thread exits soon. */
+    pthread_mutex_lock( &xBacktraceMutex );
+    pxThread->xDying = pdTRUE;
+    pthread_mutex_unlock( &xBacktraceMutex );
+}
+/*-----------------------------------------------------------*/
+
+/* Replaced by lib/cpp if the gthread keys are linked. */
+__attribute__( ( __weak__ ) ) void vPortFreeTaskKeys( void * pxTask )
+{
+    ( void ) pxTask;
+}
+/*-----------------------------------------------------------*/
+
+void vPortCancelThread( void * pxTaskToDelete )
+{
+    Thread_t * pxThreadToCancel = prvGetThreadFromTask( pxTaskToDelete );
+    int iExpected = eBacktraceABANDONED;
+
+    /* Wait for a backtrace of it in progress, later ones skip it. */
+    pthread_mutex_lock( &xBacktraceMutex );
+    pxThreadToCancel->xDying = pdTRUE;
+    pthread_mutex_unlock( &xBacktraceMutex );
+
+    /*
+     * The thread has already been suspended so it can be safely cancelled.
+     */
+    pthread_cancel( pxThreadToCancel->pthread );
+    event_signal( pxThreadToCancel->ev );
+    pthread_join( pxThreadToCancel->pthread, NULL );
+    event_delete( pxThreadToCancel->ev );
+
+    /* A handler that was given up on won't finish anymore. */
+    if( pthread_equal( xBacktraceThread, pxThreadToCancel->pthread ) != 0 )
+    {
+        ( void ) __atomic_compare_exchange_n( &iBacktraceState, &iExpected, eBacktraceIDLE, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+    }
+
+    vPortFreeTaskKeys( pxTaskToDelete );
+
+    #if ( configUSE_POSIX_PROFILER == 1 )
+        if( pxThreadToCancel->xProfiled != pdFALSE )
+        {
+            vProfilerStopTask( pxThreadToCancel->xProfilerTimer );
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+static void * prvWaitForStart( void * pvParams )
+{
+    Thread_t * pxThread = pvParams;
+
+    prvPaintHostStack( pxThread );
+
+    #if ( configUSE_POSIX_PROFILER == 1 )
+        pxThread->xProfiled = pdFALSE;
+    #endif
+
+    prvSuspendSelf( pxThread );
+
+    #if ( configNUMBER_OF_CORES > 1 )
+        prvEnterCore( pxThread->xCoreID );
+    #endif
+
+    #if ( configUSE_POSIX_PROFILER == 1 )
+    {
+        /* Still with all signals blocked, so no other task runs meanwhile. */
+        TaskHandle_t xTask = xTaskGetCurrentTaskHandle();
+
+        pxThread->xProfiled = ( iProfilerStartTask( xTask, pcTaskGetName( xTask ), &pxThread->xProfilerTimer ) == 0 ) ? pdTRUE : pdFALSE;
+    }
+    #endif
+
+    /* Resumed for the first time, unblocks all signals. */
+    #if ( configNUMBER_OF_CORES == 1 )
+        uxCriticalNesting = 0;
+    #endif
+    vPortEnableInterrupts();
+
+    /* Set thread name */
+    prvPortSetCurrentThreadName(pcTaskGetName(xTaskGetCurrentTaskHandle()));
+
+    /* Call the task's entry point. */
+    pxThread->pxCode( pxThread->pvParams );
+
+    /* A function that implements a task must not exit or attempt to return to
+     * its caller as there is nothing to return to. If a task wants to exit it
+     * should instead call vTaskDelete( NULL ). Artificially force an assert()
+     * to be triggered if configASSERT() is defined, so application writers can
+     * catch the error. */
+    configASSERT( pdFALSE );
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+#define portHOST_STACK_FILL_WORD    ( ( uintptr_t ) 0xa5a5a5a5a5a5a5a5ULL )
+#define portHOST_STACK_MARGIN       ( 1024U ) /* left untouched below the current frame */
+
+/*
+ * The task code runs on the pthread stack, not on the stack allocated by
+ * the kernel, so uxTaskGetStackHighWaterMark() can't see how much of it is
+ * used. Fill the unused part of the pthread stack with a known value before
+ * the task starts, vPortGetHostStackInfo() looks for the lowest word that
+ * was overwritten.
+ */
+static void prvPaintHostStack( Thread_t * pxThread )
+{
+    pxThread->pucHostStack = NULL;
+    pxThread->xHostStackSize = 0U;
+
+    #ifdef __linux__
+    {
+        pthread_attr_t xAttr;
+        void * pvStack;
+        size_t xSize;
+        volatile uintptr_t * puxWord;
+        uint8_t * pucFrame = ( uint8_t * ) __builtin_frame_address( 0 );
+
+        if( pthread_getattr_np( pthread_self(), &xAttr ) != 0 )
+        {
+            return;
+        }
+
+        if( ( pthread_attr_getstack( &xAttr, &pvStack, &xSize ) == 0 ) &&
+            ( pucFrame > ( uint8_t * ) pvStack + portHOST_STACK_MARGIN ) )
+        {
+            /* No memset(), its own frame lies below the current one. */
+            for( puxWord = ( volatile uintptr_t * ) pvStack; ( uint8_t * ) puxWord < pucFrame - portHOST_STACK_MARGIN; puxWord++ )
+            {
+                *puxWord = portHOST_STACK_FILL_WORD;
+            }
+
+            pxThread->pucHostStack = pvStack;
+            pxThread->xHostStackSize = xSize;
+        }
+
+        pthread_attr_destroy( &xAttr );
+    }
+    #endif /* __linux__ */
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHostStackInfo( void * pvTask,
+                            size_t * pxSize,
+                            size_t * pxMinFree )
+{
+    const Thread_t * pxThread = prvGetThreadFromTask( pvTask );
+    const uintptr_t * puxWord = ( const uintptr_t * ) pxThread->pucHostStack;
+    const uintptr_t * puxEnd = ( const uintptr_t * ) ( pxThread->pucHostStack + pxThread->xHostStackSize );
+
+    /* The stack of a task that deleted itself may already be gone. */
+    if( ( puxWord == NULL ) || ( pxThread->xDying != pdFALSE ) )
+    {
+        *pxSize = 0U;
+        *pxMinFree = 0U;
+        return;
+    }
+
+    while( ( puxWord < puxEnd ) && ( *puxWord == portHOST_STACK_FILL_WORD ) )
+    {
+        puxWord++;
+    }
+
+    *pxSize = pxThread->xHostStackSize;
+    *pxMinFree = ( size_t ) ( ( const uint8_t * ) puxWord - pxThread->pucHostStack );
+}
+/*-----------------------------------------------------------*/
+
+#define portBACKTRACE_TIMEOUT_US    ( 1000000U ) /* host time a request may take */
+#define portBACKTRACE_SKIP          ( 2U )       /* frames of prvBacktraceHandler() and the signal trampoline */
+
+typedef struct BACKTRACE_STATE
+{
+    void ** ppvFrames;
+    UBaseType_t uxMaxFrames;
+    UBaseType_t uxFrames;
+    UBaseType_t uxSkip;
+} BacktraceState_t;
+
+static _Unwind_Reason_Code prvBacktraceFrame( struct _Unwind_Context * pxContext,
+                                              void * pvState )
+{
+    BacktraceState_t * pxState = pvState;
+
+    if( pxState->uxSkip > 0U )
+    {
+        pxState->uxSkip--;
+        return _URC_NO_REASON;
+    }
+
+    if( ( pxState->uxFrames >= pxState->uxMaxFrames ) || ( _Unwind_GetIP( pxContext ) == 0U ) )
+    {
+        return _URC_END_OF_STACK;
+    }
+
+    pxState->ppvFrames[ pxState->uxFrames++ ] = ( void * ) _Unwind_GetIP( pxContext );
+
+    return _URC_NO_REASON;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * SIG_BACKTRACE is not part of xAllSignals, so a suspended thread and one
+ * in a critical section answer as well. The handler doesn't touch any
+ * kernel state, it only unwinds its own stack into pvBacktraceFrames,
+ * which the requester copies. If the requester gave up meanwhile, the
+ * frames are dropped.
+ */
+static void prvBacktraceHandler( int sig )
+{
+    BacktraceState_t xState;
+    int iExpected = eBacktraceREQUESTED;
+    int iSavedErrno = errno;
+
+    ( void ) sig;
+
+    if( ( pthread_equal( pthread_self(), xBacktraceThread ) == 0 ) ||
+        ( __atomic_compare_exchange_n( &iBacktraceState, &iExpected, eBacktraceRUNNING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) == false ) )
+    {
+        /* Stray signal or the requester gave up already. */
+        errno = iSavedErrno;
+        return;
+    }
+
+    xState.ppvFrames = pvBacktraceFrames;
+    xState.uxMaxFrames = uxBacktraceMaxFrames;
+    xState.uxFrames = 0U;
+    xState.uxSkip = portBACKTRACE_SKIP;
+    ( void ) _Unwind_Backtrace( prvBacktraceFrame, &xState );
+    uxBacktraceFrames = xState.uxFrames;
+
+    iExpected = eBacktraceRUNNING;
+
+    if( __atomic_compare_exchange_n( &iBacktraceState, &iExpected, eBacktraceDONE, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) == false )
+    {
+        /* Abandoned, drop the frames and take requests again. */
+        __atomic_store_n( &iBacktraceState, eBacktraceIDLE, __ATOMIC_RELEASE );
+    }
+
+    errno = iSavedErrno;
+}
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxPortGetTaskBacktrace( void * pvTask,
+                                    void ** ppvFrames,
+                                    UBaseType_t uxMaxFrames )
+{
+    const Thread_t * pxThread;
+    BaseType_t xFromTask;
+    UBaseType_t uxFrames = 0U;
+    const struct timespec xPoll = { 0, 20000 };
+    uint64_t ullDeadlineNs;
+    int iState = eBacktraceIDLE;
+
+    if( pvTask == NULL )
+    {
+        /* Own stack, skip this function. */
+        BacktraceState_t xState = { ppvFrames, uxMaxFrames, 0U, 1U };
+
+        ( void ) _Unwind_Backtrace( prvBacktraceFrame, &xState );
+        return xState.uxFrames;
+    }
+
+    pxThread = prvGetThreadFromTask( pvTask );
+    xFromTask = xPortIsTaskThread();
+
+    /* A requesting task doesn't switch away while it waits. A host thread
+     * must not touch the critical nesting of the running task. For both the
+     * mutex keeps the target from being deleted meanwhile. */
+    if( xFromTask != pdFALSE )
+    {
+        portENTER_CRITICAL();
+    }
+
+    /* A task deleting another one may be switched out while it holds the
+     * mutex in vPortCancelThread(), so don't wait for it forever either. */
+    ullDeadlineNs = prvGetTimeNs() + ( uint64_t ) portBACKTRACE_TIMEOUT_US * 1000U;
+
+    while( pthread_mutex_trylock( &xBacktraceMutex ) != 0 )
+    {
+        if( prvGetTimeNs() >= ullDeadlineNs )
+        {
+            if( xFromTask != pdFALSE )
+            {
+                portEXIT_CRITICAL();
+            }
+
+            return 0U;
+        }
+
+        nanosleep( &xPoll, NULL );
+    }
+
+    if( pthread_equal( pxThread->pthread, pthread_self() ) != 0 )
+    {
+        /* Own stack given by its handle. */
+        BacktraceState_t xState = { ppvFrames, uxMaxFrames, 0U, 1U };
+
+        ( void ) _Unwind_Backtrace( prvBacktraceFrame, &xState );
+        uxFrames = xState.uxFrames;
+    }
+    else if( ( pxThread->xDying == pdFALSE ) &&
+             ( __atomic_load_n( &iBacktraceState, __ATOMIC_ACQUIRE ) == eBacktraceIDLE ) )
+    {
+        /* Not idle only while a handler that was given up on still runs. */
+        xBacktraceThread = pxThread->pthread;
+        uxBacktraceMaxFrames = ( uxMaxFrames < portBACKTRACE_MAX_FRAMES ) ? uxMaxFrames : portBACKTRACE_MAX_FRAMES;
+        uxBacktraceFrames = 0U;
+        __atomic_store_n( &iBacktraceState, eBacktraceREQUESTED, __ATOMIC_RELEASE );
+
+        if( pthread_kill( pxThread->pthread, SIG_BACKTRACE ) == 0 )
+        {
+            while( ( iState = __atomic_load_n( &iBacktraceState, __ATOMIC_ACQUIRE ) ) != eBacktraceDONE )
+            {
+                /* Take the request back before the handler runs, abandon its
+                 * frames after, e.g. if the unwinder blocks on a lock. */
+                if( ( prvGetTimeNs() >= ullDeadlineNs ) &&
+                    __atomic_compare_exchange_n( &iBacktraceState, &iState,
+                                                 ( iState == eBacktraceREQUESTED ) ? eBacktraceIDLE : eBacktraceABANDONED,
+                                                 false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+                {
+                    break;
+                }
+
+                nanosleep( &xPoll, NULL );
+            }
+
+            if( iState == eBacktraceDONE )
+            {
+                uxFrames = uxBacktraceFrames;
+                memcpy( ppvFrames, pvBacktraceFrames, uxFrames * sizeof( void * ) );
+                __atomic_store_n( &iBacktraceState, eBacktraceIDLE, __ATOMIC_RELEASE );
+            }
+        }
+        else
+        {
+            __atomic_store_n( &iBacktraceState, eBacktraceIDLE, __ATOMIC_RELEASE );
+        }
+    }
+
+    pthread_mutex_unlock( &xBacktraceMutex );
+
+    if( xFromTask != pdFALSE )
+    {
+        portEXIT_CRITICAL();
+    }
+
+    return uxFrames;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSwitchThread( Thread_t * pxThreadToResume,
+                             Thread_t * pxThreadToSuspend )
+{
+    #if ( configNUMBER_OF_CORES == 1 )
+        BaseType_t uxSavedCriticalNesting;
+    #endif
+
+    #if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+        prvVirtualTimeRaiseTick();
+    #endif
+
+    if( pxThreadToSuspend != pxThreadToResume )
+    {
+        #if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+            vSchedReplaySwitch( pxThreadToSuspend->ulNumber, pxThreadToResume->ulNumber );
+        #endif
+
+        #if ( portCORE_USAGE == 1 )
+            prvCoreUsageSwitch( portGET_CORE_ID(), pxThreadToResume );
+        #endif
+
+        /*
+         * Switch tasks.
+         *
+         * The critical section nesting is per-task, so save it on the
+         * stack of the current (suspending thread), restoring it when
+         * we switch back to this task. With multiple cores it is per
+         * thread anyway, but the core may be a different one then.
+         */
+        #if ( configNUMBER_OF_CORES > 1 )
+            pxThreadToResume->xCoreID = portGET_CORE_ID();
+        #else
+            uxSavedCriticalNesting = uxCriticalNesting;
+        #endif
+
+        prvResumeThread( pxThreadToResume );
+
+        if( pxThreadToSuspend->xDying == pdTRUE )
+        {
+            pthread_exit( NULL );
+        }
+
+        prvSuspendSelf( pxThreadToSuspend );
+
+        #if ( configNUMBER_OF_CORES > 1 )
+            prvEnterCore( pxThreadToSuspend->xCoreID );
+        #else
+            uxCriticalNesting = uxSavedCriticalNesting;
+        #endif
+    }
 }
 /*-----------------------------------------------------------*/
 
 static void prvSuspendSelf( Thread_t * thread )
 {
+    int iCancelState;
+
     /*
      * Suspend this thread by waiting for a pthread_cond_signal event.
      *
@@ -549,8 +1708,14 @@ static void prvSuspendSelf( Thread_t * thread )
      * - From a signal handler that has all signals masked.
      *
      * - A thread with all signals blocked with pthread_sigmask().
+     *
+     * The wait itself isn't cancelled, a thread cancelled in
+     * pthread_cond_wait() would exit with the event's mutex held and
+     * event_signal() in vPortCancelThread() wait for it forever.
      */
+    pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, &iCancelState );
     event_wait( thread->ev );
+    pthread_setcancelstate( iCancelState, NULL );
     pthread_testcancel();
 }
 
@@ -579,6 +1744,18 @@ static void prvSetupSignalsAndSchedulerPolicy( void )
      * in a critical section. */
     sigdelset( &xAllSignals, SIGINT );
 
+    /* Backtraces are taken from suspended threads as well. */
+    sigdelset( &xAllSignals, SIG_BACKTRACE );
+
+    #if ( configUSE_POSIX_CORE_PINNING == 1 )
+        prvMapCoresToHostCPUs();
+    #endif
+
+    #if ( configUSE_POSIX_PROFILER == 1 )
+        /* Samples show where time with interrupts disabled is spent. */
+        sigdelset( &xAllSignals, SIGPROF );
+    #endif
+
     /*
      * Block all signals in this thread so all new threads
      * inherits this mask.
@@ -594,12 +1771,48 @@ static void prvSetupSignalsAndSchedulerPolicy( void )
     sigtick.sa_handler = vPortSystemTickHandler;
     sigfillset( &sigtick.sa_mask );
 
+    /* A task preempted by the tick stays suspended in the handler. */
+    sigdelset( &sigtick.sa_mask, SIG_BACKTRACE );
+
+    #if ( configUSE_POSIX_PROFILER == 1 )
+        sigdelset( &sigtick.sa_mask, SIGPROF );
+    #endif
+
     iRet = sigaction( SIGALRM, &sigtick, NULL );
 
     if( iRet == -1 )
     {
         prvFatalError( "sigaction", errno );
     }
+
+    sigtick.sa_flags = SA_RESTART;
+    sigtick.sa_handler = prvBacktraceHandler;
+
+    iRet = sigaction( SIG_BACKTRACE, &sigtick, NULL );
+
+    if( iRet == -1 )
+    {
+        prvFatalError( "sigaction", errno );
+    }
+
+    #if ( configNUMBER_OF_CORES > 1 )
+        /* Blocked like the tick, part of xAllSignals. */
+        sigtick.sa_flags = 0;
+        sigtick.sa_handler = prvYieldHandler;
+        sigfillset( &sigtick.sa_mask );
+        sigdelset( &sigtick.sa_mask, SIG_BACKTRACE );
+
+        #if ( configUSE_POSIX_PROFILER == 1 )
+            sigdelset( &sigtick.sa_mask, SIGPROF );
+        #endif
+
+        iRet = sigaction( SIG_YIELD, &sigtick, NULL );
+
+        if( iRet == -1 )
+        {
+            prvFatalError( "sigaction", errno );
+        }
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -623,19 +1836,17 @@ static inline void timespec_diff(struct timespec* a, struct timespec* b, struct
 
 uint32_t ulPortGetRunTime( void )
 {
-#if ( configUSE_TICKLESS_IDLE == 1 )
-    static struct timespec start = { 0, 0 };
-    if ( start.tv_sec == 0 )
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+    return ( uint32_t ) ullPortGetVirtualTimeUs();
+#elif ( configUSE_TICKLESS_IDLE == 1 ) || ( configNUMBER_OF_CORES > 1 )
+    /* The CPU time of the process would count every core. */
+    static uint64_t ullStartNs = 0;
+    if ( ullStartNs == 0 )
     {
-        clock_gettime(CLOCK_MONOTONIC, &start);
+        ullStartNs = ullPortGetTimeNs();
     }
 
-    struct timespec now;
-    clock_gettime( CLOCK_MONOTONIC, &now );
-    struct timespec t;
-    timespec_diff( &now, &start, &t );
-
-    return t.tv_nsec / 1000L + t.tv_sec * 1000000L;
+    return ( uint32_t ) ( ( ullPortGetTimeNs() - ullStartNs ) / 1000ULL );
 #else
     struct tms xTimes;
     times( &xTimes );
@@ -644,7 +1855,121 @@ uint32_t ulPortGetRunTime( void )
 }
 /*-----------------------------------------------------------*/
 
-#if ( configUSE_TICKLESS_IDLE == 1 )
+#if ( portCORE_USAGE == 1 )
+
+static void prvCoreUsageSwitch( BaseType_t xCoreID,
+                                const Thread_t * pxThreadToResume )
+{
+    CoreUsage_t * pxUsage = &xCoreUsage[ xCoreID ];
+    const uint64_t ullNowNs = prvGetTimeNs();
+    BaseType_t xIdle = pdFALSE;
+    BaseType_t xIdleCoreID;
+
+    if( ( pxUsage->xIdle == pdFALSE ) && ( pxUsage->ullSwitchNs != 0U ) )
+    {
+        __atomic_store_n( &pxUsage->ullBusyNs, pxUsage->ullBusyNs + ullNowNs - pxUsage->ullSwitchNs, __ATOMIC_RELAXED );
+    }
+
+    /* Idle tasks have no affinity, any of them may run on this core. */
+    for( xIdleCoreID = 0; xIdleCoreID < configNUMBER_OF_CORES; xIdleCoreID++ )
+    {
+        if( pxThreadToResume == prvGetThreadFromTask( xTaskGetIdleTaskHandleForCore( xIdleCoreID ) ) )
+        {
+            xIdle = pdTRUE;
+        }
+    }
+
+    __atomic_store_n( &pxUsage->ullSwitchNs, ullNowNs, __ATOMIC_RELAXED );
+    __atomic_store_n( &pxUsage->xIdle, xIdle, __ATOMIC_RELAXED );
+}
+
+#endif /* portCORE_USAGE */
+/*-----------------------------------------------------------*/
+
+void vPortGetCoreUsage( BaseType_t xCoreID,
+                        uint64_t * pullBusyNs,
+                        uint64_t * pullElapsedNs )
+{
+    #if ( portCORE_USAGE == 1 )
+        const CoreUsage_t * pxUsage = &xCoreUsage[ xCoreID ];
+        const uint64_t ullNowNs = prvGetTimeNs();
+        const uint64_t ullSwitchNs = __atomic_load_n( &pxUsage->ullSwitchNs, __ATOMIC_RELAXED );
+        uint64_t ullBusyNs = __atomic_load_n( &pxUsage->ullBusyNs, __ATOMIC_RELAXED );
+
+        /* Read without locks, a switch meanwhile may be counted twice. */
+        if( ( __atomic_load_n( &pxUsage->xIdle, __ATOMIC_RELAXED ) == pdFALSE ) && ( ullSwitchNs != 0U ) && ( ullNowNs > ullSwitchNs ) )
+        {
+            ullBusyNs += ullNowNs - ullSwitchNs;
+        }
+
+        *pullElapsedNs = ( ullCoreUsageStartNs != 0U ) ? ullNowNs - ullCoreUsageStartNs : 0U;
+        *pullBusyNs = ( ullBusyNs < *pullElapsedNs ) ? ullBusyNs : *pullElapsedNs;
+    #else
+        ( void ) xCoreID;
+
+        *pullBusyNs = 0U;
+        *pullElapsedNs = 0U;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+#if ( configPOSIX_HEAP == 0 )
+
+/*
+ * pvPortMalloc() uses the host malloc(), so these report the whole host
+ * heap, including allocations that don't come from FreeRTOS.
+ */
+size_t xPortGetFreeHeapSize( void )
+{
+    #if defined( __GLIBC__ ) && ( ( __GLIBC__ > 2 ) || ( __GLIBC_MINOR__ >= 33 ) )
+        return mallinfo2().fordblks;
+    #else
+        return 0U;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetUsedHeapSize( void )
+{
+    #if defined( __GLIBC__ ) && ( ( __GLIBC__ > 2 ) || ( __GLIBC_MINOR__ >= 33 ) )
+        struct mallinfo2 xInfo = mallinfo2();
+
+        return xInfo.uordblks + xInfo.hblkhd;
+    #else
+        return 0U;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configPOSIX_HEAP */
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+void vPortSleep( TickType_t ticks )
+{
+    /* Called by the idle task with the scheduler suspended. Instead of
+     * sleeping, the skipped ticks are added to the clock at once. */
+    vPortEnterCritical();
+
+    switch( eTaskConfirmSleepModeStatus() )
+    {
+        case eAbortSleep:
+            break;
+
+        case eNoTasksWaitingTimeout:
+            /* Nothing to skip to, wait for an interrupt in real time. */
+            vPortExitCritical();
+            usleep( portTICK_RATE_MICROSECONDS );
+            return;
+
+        default:
+            __atomic_fetch_add( &ullVirtualTimeUs, ( uint64_t ) ticks * portTICK_RATE_MICROSECONDS, __ATOMIC_RELAXED );
+            vTaskStepTick( ticks );
+            break;
+    }
+
+    vPortExitCritical();
+}
+#elif ( configUSE_TICKLESS_IDLE == 1 )
 void vPortSleep( TickType_t ticks )
 {
     if (ticks)
@@ -652,7 +1977,7 @@ void vPortSleep( TickType_t ticks )
         struct timespec start;
         clock_gettime( CLOCK_MONOTONIC, &start );
         struct timespec end = start;
-        end.tv_nsec += pdTICKS_TO_US( ticks ) * 1000L;
+        end.tv_nsec += ( long ) ticks * ( long ) ulPortGetTickPeriodUs() * 1000L;
         struct timespec now, to_sleep;
         while ( pdTRUE )
         {
@@ -103,26 +103,108 @@ extern void vPortYield( void );
 /* Critical section management. */
 extern void vPortDisableInterrupts( void );
 extern void vPortEnableInterrupts( void );
-#define portSET_INTERRUPT_MASK()      ( vPortDisableInterrupts() )
-#define portCLEAR_INTERRUPT_MASK()    ( vPortEnableInterrupts() )
 
 extern UBaseType_t xPortSetInterruptMask( void );
 extern void vPortClearInterruptMask( UBaseType_t xMask );
 
-extern void vPortEnterCritical( void );
-extern void vPortExitCritical( void );
-#define portSET_INTERRUPT_MASK_FROM_ISR()         xPortSetInterruptMask()
-#define portCLEAR_INTERRUPT_MASK_FROM_ISR( x )    vPortClearInterruptMask( x )
-#define portDISABLE_INTERRUPTS()                  portSET_INTERRUPT_MASK()
-#define portENABLE_INTERRUPTS()                   portCLEAR_INTERRUPT_MASK()
-#define portENTER_CRITICAL()                      vPortEnterCritical()
-#define portEXIT_CRITICAL()                       vPortExitCritical()
+#if ( configNUMBER_OF_CORES > 1 )
+    /* The kernel's critical sections are used, they take the task and ISR
+     * locks below. The mask functions return and restore the previous state
+     * of the calling thread. */
+    extern void vTaskEnterCritical( void );
+    extern void vTaskExitCritical( void );
+    extern UBaseType_t vTaskEnterCriticalFromISR( void );
+    extern void vTaskExitCriticalFromISR( UBaseType_t uxSavedInterruptStatus );
+    #define portSET_INTERRUPT_MASK()                  xPortSetInterruptMask()
+    #define portCLEAR_INTERRUPT_MASK( x )             vPortClearInterruptMask( x )
+    #define portSET_INTERRUPT_MASK_FROM_ISR()         xPortSetInterruptMask()
+    #define portCLEAR_INTERRUPT_MASK_FROM_ISR( x )    vPortClearInterruptMask( x )
+    #define portDISABLE_INTERRUPTS()                  vPortDisableInterrupts()
+    #define portENABLE_INTERRUPTS()                   vPortEnableInterrupts()
+    #define portENTER_CRITICAL()                      vTaskEnterCritical()
+    #define portEXIT_CRITICAL()                       vTaskExitCritical()
+    #define portENTER_CRITICAL_FROM_ISR()             vTaskEnterCriticalFromISR()
+    #define portEXIT_CRITICAL_FROM_ISR( x )           vTaskExitCriticalFromISR( x )
+#else
+    #define portSET_INTERRUPT_MASK()                  ( vPortDisableInterrupts() )
+    #define portCLEAR_INTERRUPT_MASK()                ( vPortEnableInterrupts() )
 
+    extern void vPortEnterCritical( void );
+    extern void vPortExitCritical( void );
+    #define portSET_INTERRUPT_MASK_FROM_ISR()         xPortSetInterruptMask()
+    #define portCLEAR_INTERRUPT_MASK_FROM_ISR( x )    vPortClearInterruptMask( x )
+    #define portDISABLE_INTERRUPTS()                  portSET_INTERRUPT_MASK()
+    #define portENABLE_INTERRUPTS()                   portCLEAR_INTERRUPT_MASK()
+    #define portENTER_CRITICAL()                      vPortEnterCritical()
+    #define portEXIT_CRITICAL()                       vPortExitCritical()
+#endif /* configNUMBER_OF_CORES */
+
+/* Reaction to errors of freertos::error_blink(), see FreeRTOSConfig.h. */
+#ifndef configPOSIX_ERROR_POLICY
+    #define configPOSIX_ERROR_POLICY    0
+#endif
+
+#if ( configPOSIX_ERROR_POLICY == 3 )
+    /* To be implemented by the application, ucCode is the number of LED
+     * pulses of the error: 1 for a failed assert, 3 for a stack overflow.
+     * abort() is called if it returns. */
+    extern void vApplicationErrorHook( uint8_t ucCode );
+#endif
+
+/* pdTRUE if the calling thread has interrupts (the tick signal) masked. */
+extern BaseType_t xPortInterruptsDisabled( void );
+
+/* pdTRUE if the calling thread is the thread of the running task, pdFALSE
+ * for host threads that aren't tasks. */
+extern BaseType_t xPortIsTaskThread( void );
+
+/*-----------------------------------------------------------*/
+
+#if ( configNUMBER_OF_CORES > 1 )
+    /* Multi core. Each core runs the thread of its current task, so the
+     * core number and the critical nesting count are kept per thread. They
+     * are only valid in task threads, other host threads read core 0. */
+    extern __thread volatile BaseType_t xPortCoreID;
+    extern __thread volatile UBaseType_t uxPortCriticalNesting;
+
+    extern void vPortYieldCore( BaseType_t xCoreID );
+
+    /* Sleep until the next signal (tick or yield request) was handled, like
+     * a WFI instruction. Called by a task with interrupts enabled. */
+    extern void vPortWaitForInterrupt( void );
+
+    /* Host CPU the threads running on xCoreID are pinned to, -1 without
+     * configUSE_POSIX_CORE_PINNING. */
+    extern int iPortGetCoreHostCPU( BaseType_t xCoreID );
+
+    extern void vPortRecursiveLockGet( BaseType_t xLockNum );
+    extern void vPortRecursiveLockRelease( BaseType_t xLockNum );
+
+    #define portTASK_LOCK                             ( 0 )
+    #define portISR_LOCK                              ( 1 )
+
+    #define portGET_CORE_ID()                         ( xPortCoreID )
+    #define portYIELD_CORE( xCoreID )                 vPortYieldCore( xCoreID )
+    #define portGET_TASK_LOCK()                       vPortRecursiveLockGet( portTASK_LOCK )
+    #define portRELEASE_TASK_LOCK()                   vPortRecursiveLockRelease( portTASK_LOCK )
+    #define portGET_ISR_LOCK()                        vPortRecursiveLockGet( portISR_LOCK )
+    #define portRELEASE_ISR_LOCK()                    vPortRecursiveLockRelease( portISR_LOCK )
+
+    #define portGET_CRITICAL_NESTING_COUNT()          ( uxPortCriticalNesting )
+    #define portSET_CRITICAL_NESTING_COUNT( x )       ( uxPortCriticalNesting = ( x ) )
+    #define portINCREMENT_CRITICAL_NESTING_COUNT()    ( uxPortCriticalNesting++ )
+    #define portDECREMENT_CRITICAL_NESTING_COUNT()    ( uxPortCriticalNesting-- )
+#endif /* configNUMBER_OF_CORES */
 /*-----------------------------------------------------------*/
 
 extern void vPortThreadDying( void * pxTaskToDelete,
                               volatile BaseType_t * pxPendYield );
 extern void vPortCancelThread( void * pxTaskToDelete );
+
+/* Called by vPortCancelThread(), frees the values of the C++ thread specific
+ * keys (lib/cpp) of a task that was deleted with vTaskDelete() without running
+ * their destructors. Does nothing unless lib/cpp uses the keys. */
+extern void vPortFreeTaskKeys( void * pxTask );
 #define portPRE_TASK_DELETE_HOOK( pvTaskToDelete, pxPendYield )    vPortThreadDying( ( pvTaskToDelete ), ( pxPendYield ) )
 #define portCLEAN_UP_TCB( pxTCB )                                  vPortCancelThread( pxTCB )
 /*-----------------------------------------------------------*/
@@ -139,7 +221,13 @@ extern void vPortCancelThread( void * pxTaskToDelete );
  * Thus, only a compilier barrier is needed to prevent the compiler
  * reordering.
  */
-#define portMEMORY_BARRIER()                        __asm volatile ( "" ::: "memory" )
+#if configUSE_POSIX_SCHED_REPLAY == 1
+    /* Suspending the scheduler is a replay point, see utils/sched_replay.h. */
+    extern void vPortSchedReplayPoint( void );
+    #define portMEMORY_BARRIER()                    do { __asm volatile ( "" ::: "memory" ); vPortSchedReplayPoint(); } while( 0 )
+#else
+    #define portMEMORY_BARRIER()                    __asm volatile ( "" ::: "memory" )
+#endif
 #define portDATA_SYNC_BARRIER()  __asm volatile( "" ::: "memory" )
 #define portINSTR_SYNC_BARRIER()
 
@@ -147,11 +235,51 @@ extern uint32_t ulPortGetRunTime( void );
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    /* no-op */
 #define portGET_RUN_TIME_COUNTER_VALUE()            ulPortGetRunTime()
 
+/* Host time in ns core xCoreID spent running other tasks than the idle tasks
+ * and the time since the scheduler was started. Both 0 without
+ * configGENERATE_RUN_TIME_STATS and INCLUDE_xTaskGetIdleTaskHandle. */
+extern void vPortGetCoreUsage( BaseType_t xCoreID, uint64_t * pullBusyNs, uint64_t * pullElapsedNs );
+
 #if configUSE_TICKLESS_IDLE == 1
     extern void vPortSleep(TickType_t ticks);
     #define portSUPPRESS_TICKS_AND_SLEEP( ticks ) vPortSleep( ticks )
 #endif
 
+#if configUSE_POSIX_VIRTUAL_TIME == 1
+    /* Simulated time since the scheduler was started, see port.c. */
+    extern uint64_t ullPortGetVirtualTimeUs( void );
+    extern void vPortAdvanceVirtualTime( uint64_t ullTimeUs );
+#else
+    /* Host time scaled by the tick period, which can be changed at run time
+     * to let the application run faster (or slower) than real time. */
+    extern uint64_t ullPortGetTimeNs( void );
+    extern uint32_t ulPortGetTickPeriodUs( void );
+    extern void vPortSetTickPeriodUs( uint32_t ulPeriodUs );
+#endif
+
+/* Bytes allocated with pvPortMalloc() and not freed yet, including the
+ * block headers. xPortGetFreeHeapSize() is declared in portable.h. */
+extern size_t xPortGetUsedHeapSize( void );
+
+/* Size of the pthread stack a task runs on and the minimum number of bytes
+ * of it that have remained unused so far, both 0 if unknown. */
+extern void vPortGetHostStackInfo( void * pvTask, size_t * pxSize, size_t * pxMinFree );
+
+/* Return addresses of the call stack of a task, innermost first. The
+ * stack of another task is taken by signalling its thread, NULL stands for
+ * the calling thread. At most 64 frames are taken from another task, which
+ * isn't deleted before the request is answered or given up. Returns the
+ * number of frames stored, 0 on failure. */
+extern UBaseType_t uxPortGetTaskBacktrace( void * pvTask, void ** ppvFrames, UBaseType_t uxMaxFrames );
+
+#if configUSE_MUTEXES == 1
+/* Count a lock that isn't a FreeRTOS mutex in the mutexes held by its
+ * holder, see freertos_tasks_c_additions.h. */
+extern void vTaskAddMutexHeld( void * pvMutexHolder );
+#endif
+
+#if configPOSIX_HEAP == 0
+/* Host malloc(), see FreeRTOSConfig.h for the alternatives. */
 static inline void* pvPortMalloc( size_t xSize ) __attribute__( ( __malloc__, __warn_unused_result__, __alloc_size__( 1 ) ) );
 static inline void* pvPortMalloc( size_t xSize ) {
     portENTER_CRITICAL();
@@ -173,6 +301,7 @@ static inline void vPortFree( void* pv ) {
     free( pv );
     portEXIT_CRITICAL();
 }
+#endif /* configPOSIX_HEAP */
 
 #ifdef __cplusplus
     }
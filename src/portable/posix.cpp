@@ -28,11 +28,17 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/time.h>
-#include <unwind.h>
+#include <ctime>
+#include <dlfcn.h>
+#include <cxxabi.h>
 #include <cstdio>
-#include <cmath>
+#include <cstdlib>
 #include <tuple>
 #include <new>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #ifdef _POSIX_PRIORITY_SCHEDULING
 #include <sched.h>
@@ -40,7 +46,16 @@
 
 #include "posix.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "semphr.h"
+#if configUSE_POSIX_PROFILER == 1
+#include "utils/profiler.h"
+#endif
+
+#ifdef __linux__
+// Section boundaries provided by the linker
+extern "C" char __executable_start[], etext[], __data_start[], _edata[], __bss_start[], _end[];
+#endif
 
 
 extern "C" {
@@ -56,13 +71,6 @@ __attribute__((weak)) void serialport_flush() {
     ::fflush(stdout);
 }
 
-_Unwind_Reason_Code trace_fcn(_Unwind_Context* ctx, void* depth) {
-    int* p_depth { static_cast<int*>(depth) };
-    ::printf("\t#%d: pc at 0x%lx\r\n", *p_depth, _Unwind_GetIP(ctx));
-    (*p_depth)++;
-    return _URC_NO_REASON;
-}
-
 /**
  * @brief Print assert message and blink one short pulse every two seconds
  * @param[in] file: Filename as C-string
@@ -71,11 +79,11 @@ _Unwind_Reason_Code trace_fcn(_Unwind_Context* ctx, void* depth) {
  * @param[in] expr: Expression that failed as C-string
  */
 void assert_blink(const char* file, int line, const char* func, const char* expr) {
-    ::printf("\r\nASSERT in [%s:%d]\r\n\t%s: %s\r\n\n", file, line, func, expr);
+    ::printf("\r\nASSERT in [%s:%d]\r\n\t%s: %s\r\n", file, line, func, expr);
+    freertos::print_error_context();
 
     ::puts("Stack trace:");
-    int depth { 0 };
-    _Unwind_Backtrace(&trace_fcn, &depth);
+    freertos::print_stack_trace(nullptr);
     ::puts("");
 
     freertos::error_blink(1);
@@ -89,35 +97,127 @@ void mcu_shutdown() {
 
 namespace freertos {
 uint32_t get_ms() {
-    struct timespec spec;
-    ::clock_gettime(CLOCK_MONOTONIC, &spec);
+#if configUSE_POSIX_VIRTUAL_TIME == 1
+    return ::ullPortGetVirtualTimeUs() / 1'000UL;
+#else
+    const auto ns { ::ullPortGetTimeNs() }; // scaled by the tick period set with vPortSetTickPeriodUs()
 
-    const auto s { spec.tv_sec };
-    const auto ms { static_cast<uint64_t>(round(spec.tv_nsec / 1.0e6)) }; // Convert nanoseconds to milliseconds
-
-    return s * 1'000UL + ms;
+    return static_cast<uint32_t>(ns / 1'000'000ULL); // truncate, so get_ms() == get_us() / 1000
+#endif
 }
 
 uint64_t get_us() {
-    struct timespec spec;
-    ::clock_gettime(CLOCK_MONOTONIC, &spec);
+#if configUSE_POSIX_VIRTUAL_TIME == 1
+    return ::ullPortGetVirtualTimeUs();
+#else
+    const auto ns { ::ullPortGetTimeNs() }; // scaled by the tick period set with vPortSetTickPeriodUs()
 
-    const auto s { spec.tv_sec };
-    const auto us { static_cast<uint64_t>(round(spec.tv_nsec / 1.0e3)) }; // Convert nanoseconds to microseconds
-
-    return s * 1'000'000UL + us;
+    return ns / 1'000ULL; // Convert nanoseconds to microseconds
+#endif
 }
 
 uint64_t get_us_from_isr() {
     return get_us();
 }
 
-void delay_ms(const uint32_t ms) {
-    const auto start { get_ms() };
-    while (get_ms() - start < ms) {
+namespace {
+#if configUSE_POSIX_VIRTUAL_TIME == 0
+void sleep_until(const uint64_t deadline) {
+    for (auto now { get_us() }; now < deadline; now = get_us()) {
+        const uint64_t ns { (deadline - now) * 1'000ULL * ::ulPortGetTickPeriodUs() / portTICK_RATE_MICROSECONDS };
+        const timespec ts { static_cast<time_t>(ns / 1'000'000'000ULL), static_cast<long>(ns % 1'000'000'000ULL) };
+        ::clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, nullptr);
+    }
+}
+#endif
+
+void delay(const uint64_t us) {
+    const bool task { ::xPortIsTaskThread() == pdTRUE };
+
+#if configUSE_POSIX_VIRTUAL_TIME == 1
+    if (task && ::xPortInterruptsDisabled()) {
+        // no tick can be processed, so only a part of a tick may pass on the simulated clock
+        configASSERT(us < portTICK_RATE_MICROSECONDS);
+        ::vPortAdvanceVirtualTime(us);
+    } else if (task && ::xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        // whole ticks pass in the kernel, only the rest is added to the clock, so it stays in pace with the tick count
+        if (us >= portTICK_RATE_MICROSECONDS) {
+            ::vTaskDelay(static_cast<TickType_t>(us / portTICK_RATE_MICROSECONDS));
+        }
+        ::vPortAdvanceVirtualTime(us % portTICK_RATE_MICROSECONDS);
+    } else {
+        // a host thread or a scheduler that isn't running can't move the simulated clock, wait in real time
+        const timespec ts { static_cast<time_t>(us / 1'000'000ULL), static_cast<long>(us % 1'000'000ULL * 1'000ULL) };
+        while (::clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, nullptr) == EINTR) {
+        }
+    }
+#else
+    const auto deadline { get_us() + us };
+
+    if (task && ::xPortInterruptsDisabled()) {
+        // no tick can arrive anyway, spin as on the target
+        while (get_us() < deadline) {
 #ifdef _POSIX_PRIORITY_SCHEDULING
-        sched_yield();
+            sched_yield();
+#endif
+        }
+        return;
+    }
+
+    // a running task gives up the simulated CPU for all whole ticks of the delay. They are taken from the requested time
+    // and not from the host clock, so the kernel calls don't depend on host timing and a recorded schedule replays.
+    if (task && ::xTaskGetSchedulerState() == taskSCHEDULER_RUNNING && us >= portTICK_RATE_MICROSECONDS) {
+        ::vTaskDelay(static_cast<TickType_t>(us / portTICK_RATE_MICROSECONDS));
+    }
+
+    // the rest of a tick, a scheduler that isn't running or a host thread: sleep on the host
+    sleep_until(deadline);
 #endif
+}
+} // namespace
+
+void delay_ms(const uint32_t ms) {
+    delay(ms * 1'000ULL);
+}
+
+void delay_us(const uint32_t us) {
+    delay(us);
+}
+
+namespace {
+/**
+ * @brief Get the error policy, configPOSIX_ERROR_POLICY or the one set with the environment variable FREERTOS_ERROR_POLICY
+ * @param[out] from_env: Set to true if the policy was selected with FREERTOS_ERROR_POLICY
+ * @return 0: blink, 1: abort, 2: exit, 3: hook
+ */
+int error_policy(bool& from_env) {
+    static constexpr const char* names[] { "blink", "abort", "exit", "hook" };
+
+    const char* env { ::getenv("FREERTOS_ERROR_POLICY") };
+    if (env) {
+        // the hook is only there if it's configured
+        for (int i {}; i < (configPOSIX_ERROR_POLICY == 3 ? 4 : 3); ++i) {
+            if (std::strcmp(env, names[i]) == 0) {
+                from_env = true;
+                return i;
+            }
+        }
+        ::printf("unknown FREERTOS_ERROR_POLICY \"%s\" ignored\r\n", env);
+    }
+
+    from_env = false;
+    return configPOSIX_ERROR_POLICY;
+}
+} // namespace
+
+void print_error_context() {
+    const auto tick { static_cast<unsigned long>(::xTaskGetTickCount()) };
+    const auto us { static_cast<unsigned long long>(get_us()) };
+
+    if (::xPortIsTaskThread()) {
+        ::printf("\ttask: %s, tick: %lu, time: %llu us\r\n", ::pcTaskGetName(nullptr), tick, us);
+    } else {
+        ::printf("\ttask: none (host thread), tick: %lu, time: %llu us\r\n", tick, us);
     }
 }
 
@@ -126,40 +226,284 @@ void error_blink(const uint8_t n) {
         exit(0);
     }
 
+    ::fflush(stdout);
+
+#if configUSE_POSIX_PROFILER == 1
+    // abort() and _exit() skip the atexit() handler, and blinking never returns
+    ::vProfilerFlush();
+#endif
+
+    bool from_env;
+    switch (error_policy(from_env)) {
+        case 1:
+            ::abort();
+
+        case 2:
+            // other task threads still run, so skip static destructors and atexit handlers
+            ::_exit(n);
+
+#if configPOSIX_ERROR_POLICY == 3
+        case 3:
+            ::vApplicationErrorHook(n);
+            ::abort();
+#endif
+
+        default:
+            break;
+    }
+
     ::vTaskSuspendAll();
 
-    struct timeval end, now;
+    // a run that isn't watched, e.g. in CI, would hang here
+    ::printf("error policy blink (%s), FREERTOS_ERROR_POLICY=abort or exit ends the run instead\r\n",
+        from_env ? "FREERTOS_ERROR_POLICY" : "configPOSIX_ERROR_POLICY");
+
+    // as on the target, but sleep instead of spinning on the host
+    timespec next;
+    ::clock_gettime(CLOCK_MONOTONIC, &next);
     while (true) {
-        ::gettimeofday(&end, nullptr);
-        end.tv_sec += 2;
-        ::gettimeofday(&now, nullptr);
         ::printf("error_blink(%u)\r\n", n);
         ::fflush(stdout);
 
-        while (timercmp(&now, &end, <)) {
-            ::gettimeofday(&now, nullptr);
+        next.tv_sec += 2;
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR) {
+        }
+    }
+}
+
+namespace {
+/**
+ * @brief Read a value from a file in /proc
+ * @param[in] path: File to read
+ * @param[in] format: scanf format that stores one size_t
+ * @return Value read or 0 on error
+ */
+size_t read_proc(const char* path, const char* format) {
+    size_t value {};
+    FILE* file { ::fopen(path, "r") };
+    if (!file) {
+        return 0;
+    }
+
+    char line[128];
+    while (::fgets(line, sizeof(line), file)) {
+        if (::sscanf(line, format, &value) == 1) {
+            break;
         }
     }
+    ::fclose(file);
+
+    return value;
 }
 
-void print_ram_usage() {
-    // not implemented
+struct task_memory {
+    char name[configMAX_TASK_NAME_LEN + 1];
+    UBaseType_t prio;
+    size_t stack_size;
+    size_t stack_min_free;
+    size_t host_stack_size;
+    size_t host_stack_min_free;
+};
+
+std::vector<task_memory> tasks_memory() {
+    std::vector<task_memory> result;
+#if configUSE_TRACE_FACILITY == 1
+    std::vector<TaskStatus_t> status(::uxTaskGetNumberOfTasks() + 4);
+
+    // keep the tasks from being deleted while their stacks are inspected
+    ::vTaskSuspendAll();
+    status.resize(::uxTaskGetSystemState(status.data(), status.size(), nullptr));
+    for (const auto& task : status) {
+        if (task.eCurrentState == eDeleted) {
+            continue;
+        }
+
+        task_memory mem {};
+        std::strncpy(mem.name, task.pcTaskName, configMAX_TASK_NAME_LEN);
+        mem.prio = task.uxCurrentPriority;
+#if configRECORD_STACK_HIGH_ADDRESS == 1
+        mem.stack_size = (task.pxEndOfStack - task.pxStackBase + 1) * sizeof(StackType_t);
+#endif
+        mem.stack_min_free = task.usStackHighWaterMark * sizeof(StackType_t);
+        ::vPortGetHostStackInfo(task.xHandle, &mem.host_stack_size, &mem.host_stack_min_free);
+        result.push_back(mem);
+    }
+    ::xTaskResumeAll();
+#endif // configUSE_TRACE_FACILITY
+
+    return result;
+}
+
+void print_json_string(const char* str) {
+    ::putchar('"');
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') {
+            ::putchar('\\');
+        }
+        ::putchar(*str);
+    }
+    ::putchar('"');
+}
+} // namespace
+
+void print_ram_usage(bool json) {
+    const auto info1 { ram1_usage() };
+    const auto info2 { ram2_usage() };
+    const auto tasks { tasks_memory() };
+
+    if (json) {
+        ::printf("{\"ram1\":{\"size\":%zu,\"free\":%zu,\"data\":%zu,\"bss\":%zu,\"heap_used\":%zu,\"system_free\":%zu,\"code\":%zu},",
+            std::get<6>(info1), std::get<0>(info1), std::get<1>(info1), std::get<2>(info1), std::get<3>(info1), std::get<4>(info1),
+            std::get<5>(info1));
+        ::printf("\"ram2\":{\"size\":%zu,\"free\":%zu},\"tasks\":[", std::get<1>(info2), std::get<0>(info2));
+        for (size_t i {}; i < tasks.size(); ++i) {
+            ::printf("%s{\"name\":", i ? "," : "");
+            print_json_string(tasks[i].name);
+            ::printf(",\"prio\":%lu,\"stack_size\":%zu,\"stack_min_free\":%zu,\"host_stack_size\":%zu,\"host_stack_min_free\":%zu}",
+                static_cast<unsigned long>(tasks[i].prio), tasks[i].stack_size, tasks[i].stack_min_free, tasks[i].host_stack_size,
+                tasks[i].host_stack_min_free);
+        }
+        ::puts("]}");
+    } else {
+        ::printf("RAM1 size: %zu KB, free RAM1: %zu KB, data used: %zu KB, bss used: %zu KB, used heap: %zu KB, system free: %zu KB, code: %zu KB\r\n",
+            std::get<6>(info1) / 1024UL, std::get<0>(info1) / 1024UL, std::get<1>(info1) / 1024UL, std::get<2>(info1) / 1024UL,
+            std::get<3>(info1) / 1024UL, std::get<4>(info1) / 1024UL, std::get<5>(info1) / 1024UL);
+        ::printf("RAM2 size: %zu KB, free RAM2: %zu KB\r\n", std::get<1>(info2) / 1024UL, std::get<0>(info2) / 1024UL);
+        ::printf("%-*s prio  stack B  min free B  host stack B  host min free B\r\n", configMAX_TASK_NAME_LEN, "task");
+        for (const auto& task : tasks) {
+            ::printf("%-*s %4lu %8zu %11zu %13zu %16zu\r\n", configMAX_TASK_NAME_LEN, task.name, static_cast<unsigned long>(task.prio),
+                task.stack_size, task.stack_min_free, task.host_stack_size, task.host_stack_min_free);
+        }
+    }
+    ::fflush(stdout);
+}
+
+void print_core_usage(bool json) {
+    if (json) {
+        ::printf("{\"cores\":[");
+    } else {
+        ::printf("core  host CPU  busy %%\r\n");
+    }
+    for (BaseType_t core {}; core < configNUMBER_OF_CORES; ++core) {
+        uint64_t busy_ns, elapsed_ns;
+        ::vPortGetCoreUsage(core, &busy_ns, &elapsed_ns);
+        const double busy { elapsed_ns ? 100. * busy_ns / elapsed_ns : 0. };
+#if configNUMBER_OF_CORES > 1
+        const int cpu { ::iPortGetCoreHostCPU(core) };
+#else
+        const int cpu { -1 };
+#endif
+
+        if (json) {
+            ::printf("%s{\"core\":%ld,\"host_cpu\":%d,\"busy\":%.1f}", core ? "," : "", static_cast<long>(core), cpu, busy);
+        } else {
+            ::printf("%4ld %9d %6.1f\r\n", static_cast<long>(core), cpu, busy);
+        }
+    }
+    if (json) {
+        ::puts("]}");
+    }
+    ::fflush(stdout);
 }
 
 std::tuple<size_t, size_t, size_t, size_t, size_t, size_t, size_t> ram1_usage() {
-    return { 0, 0, 0, 0, 0, 0, 0 };
+    const size_t heap_free { ::xPortGetFreeHeapSize() };
+    const size_t heap_used { ::xPortGetUsedHeapSize() };
+#ifdef __linux__
+    const size_t data { static_cast<size_t>(_edata - __data_start) };
+    const size_t bss { static_cast<size_t>(_end - __bss_start) };
+    const size_t code { static_cast<size_t>(etext - __executable_start) };
+    const size_t system_free { read_proc("/proc/meminfo", "MemAvailable: %zu kB") * 1024UL };
+    const size_t rss { read_proc("/proc/self/statm", "%*zu %zu") * static_cast<size_t>(::sysconf(_SC_PAGESIZE)) };
+
+    return { heap_free, data, bss, heap_used, system_free, code, rss };
+#else
+    return { heap_free, 0, 0, heap_used, 0, 0, 0 };
+#endif
 }
 
 std::tuple<size_t, size_t> ram2_usage() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const auto info { ::mallinfo2() };
+
+    return { info.fordblks, info.arena + info.hblkhd };
+#else
     return { 0, 0 };
+#endif
 }
 
 std::tuple<size_t, size_t> ram3_usage() {
     return { 0, 0 };
 }
 
-void print_stack_trace(void*) {
-    // not implemented
+namespace {
+/**
+ * @brief Print one frame of a stack trace
+ * @param[in] n: Number of the frame
+ * @param[in] pc: Return address of the frame
+ * @note Names are taken from the dynamic symbol table, link with -rdynamic to see the functions of the executable.
+ *       Otherwise the offset into the module is printed, which addr2line -f -C -e <module> resolves.
+ */
+void print_frame(unsigned n, void* pc) {
+    Dl_info info {};
+    // a return address may already belong to the next function, so look up the call instruction
+    if (!::dladdr(static_cast<char*>(pc) - 1, &info) || !info.dli_fname) {
+        ::printf("\t#%u: pc at %p\r\n", n, pc);
+        return;
+    }
+
+    const char* module { std::strrchr(info.dli_fname, '/') };
+    module = module ? module + 1 : info.dli_fname;
+    if (!info.dli_sname) {
+        ::printf("\t#%u: pc at %p in %s+0x%zx\r\n", n, pc, module,
+            static_cast<size_t>(static_cast<char*>(pc) - static_cast<char*>(info.dli_fbase)));
+        return;
+    }
+
+    int status;
+    char* demangled { abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status) };
+    ::printf("\t#%u: pc at %p in %s+0x%zx (%s)\r\n", n, pc, status == 0 ? demangled : info.dli_sname,
+        static_cast<size_t>(static_cast<char*>(pc) - static_cast<char*>(info.dli_saddr)), module);
+    std::free(demangled);
+}
+} // namespace
+
+void print_stack_trace(void* task) {
+    static constexpr UBaseType_t MAX_FRAMES { 64 };
+    void* frames[MAX_FRAMES];
+
+    // the running task is only the own stack on its thread, a host thread (e.g. a watchdog) has to signal it
+    const bool own { !task || (task == ::xTaskGetCurrentTaskHandle() && ::xPortIsTaskThread()) };
+    const auto n { ::uxPortGetTaskBacktrace(own ? nullptr : task, frames, MAX_FRAMES) };
+    if (!n) {
+        ::printf("\tno stack trace available\r\n");
+    }
+    // skip this function for the own stack
+    for (UBaseType_t i { own ? 1U : 0U }; i < n; ++i) {
+        print_frame(own ? i - 1 : i, frames[i]);
+    }
+    ::fflush(stdout);
+}
+
+void print_all_stack_traces() {
+#if configUSE_TRACE_FACILITY == 1
+    static constexpr char states[] { 'X', 'R', 'B', 'S', 'D', 'I' }; // as vTaskList(), see eTaskState
+
+    std::vector<TaskStatus_t> status(::uxTaskGetNumberOfTasks() + 4);
+
+    // keep the tasks from being deleted while their stacks are taken
+    ::vTaskSuspendAll();
+    status.resize(::uxTaskGetSystemState(status.data(), status.size(), nullptr));
+    for (const auto& task : status) {
+        if (task.eCurrentState == eDeleted) {
+            continue;
+        }
+        ::printf("Task \"%s\" [%c] prio %lu:\r\n", task.pcTaskName, states[task.eCurrentState],
+            static_cast<unsigned long>(task.uxCurrentPriority));
+        print_stack_trace(task.xHandle);
+    }
+    ::xTaskResumeAll();
+#endif // configUSE_TRACE_FACILITY
 }
 } // namespace freertos
 
@@ -175,6 +519,19 @@ void vApplicationGetIdleTaskMemory(StaticTask_t** ppxIdleTaskTCBBuffer, StackTyp
     *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
 }
 
+#if configNUMBER_OF_CORES > 1
+void vApplicationGetPassiveIdleTaskMemory(
+    StaticTask_t** ppxIdleTaskTCBBuffer, StackType_t** ppxIdleTaskStackBuffer, uint32_t* pulIdleTaskStackSize, BaseType_t xPassiveIdleTaskIndex) {
+    static StaticTask_t xIdleTaskTCBs[configNUMBER_OF_CORES - 1];
+    static std::align_val_t stack_align { portBYTE_ALIGNMENT };
+    static StackType_t* uxIdleTaskStacks { new (stack_align) StackType_t[(configNUMBER_OF_CORES - 1) * configMINIMAL_STACK_SIZE] };
+
+    *ppxIdleTaskTCBBuffer = &xIdleTaskTCBs[xPassiveIdleTaskIndex];
+    *ppxIdleTaskStackBuffer = &uxIdleTaskStacks[xPassiveIdleTaskIndex * configMINIMAL_STACK_SIZE];
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+#endif // configNUMBER_OF_CORES
+
 #if configUSE_TIMERS == 1
 void vApplicationGetTimerTaskMemory(StaticTask_t** ppxTimerTaskTCBBuffer, StackType_t** ppxTimerTaskStackBuffer, uint32_t* pulTimerTaskStackSize) {
     static StaticTask_t xTimerTaskTCB;
@@ -188,13 +545,23 @@ void vApplicationGetTimerTaskMemory(StaticTask_t** ppxTimerTaskTCBBuffer, StackT
 #endif // configUSE_TIMERS
 #endif // configSUPPORT_STATIC_ALLOCATION
 
+#if configNUMBER_OF_CORES > 1 && configUSE_PASSIVE_IDLE_HOOK == 1
+__attribute__((weak)) void vApplicationPassiveIdleHook() {
+    ::vPortWaitForInterrupt();
+}
+#endif // configNUMBER_OF_CORES && configUSE_PASSIVE_IDLE_HOOK
+
 #if configCHECK_FOR_STACK_OVERFLOW > 0
-void vApplicationStackOverflowHook(TaskHandle_t, char* task_name) {
+void vApplicationStackOverflowHook(TaskHandle_t task, char* task_name) {
     static char taskname[configMAX_TASK_NAME_LEN + 1];
 
     std::memcpy(taskname, task_name, configMAX_TASK_NAME_LEN);
-    ::puts("STACK OVERFLOW: ");
-    ::puts(taskname);
+    ::printf("\r\nSTACK OVERFLOW in task %s\r\n", taskname);
+    freertos::print_error_context();
+
+    ::puts("Stack trace:");
+    freertos::print_stack_trace(task);
+    ::puts("");
 
     freertos::error_blink(3);
 }
@@ -51,7 +51,7 @@ void serialport_puts(const char* str);
 void serialport_flush();
 
 /**
- * @brief Print assert message and blink one short pulse every two seconds
+ * @brief Print assert message with the running task, tick count and stack trace and blink one short pulse every two seconds
  * @param[in] file: Filename as C-string
  * @param[in] line: Line number
  * @param[in] func: Function name as C-string
@@ -64,44 +64,83 @@ namespace freertos {
 /**
  * @brief Delay between led error flashes
  * @param[in] ms: Milliseconds to delay
- * @note Doesn't use a timer to work with interrupts disabled
+ * @note A running task is delayed with vTaskDelay() for all whole ticks and sleeps on the host for the rest. Without a running
+ *       scheduler or from a host thread it sleeps on the host, with interrupts disabled it spins as on the target
+ * @note With configUSE_POSIX_VIRTUAL_TIME only the rest of a tick of a running task is added to the simulated clock, so it
+ *       stays in pace with the tick count. Host threads and a scheduler that isn't running wait in real time, with interrupts
+ *       disabled the delay has to be shorter than a tick
  */
 void delay_ms(const uint32_t ms);
 
+/**
+ * @brief Delay for a number of microseconds
+ * @param[in] us: Microseconds to delay
+ * @note Works like delay_ms()
+ */
+void delay_us(const uint32_t us);
+
 /**
  * @brief Indicate an error with the onboard LED
  * @param[in] n: Number of short LED pulses to encode the error
+ * @note On the host the reaction is selected with configPOSIX_ERROR_POLICY or at run time with the environment variable
+ *       FREERTOS_ERROR_POLICY set to blink, abort, exit or hook: print a message every two seconds without using the CPU,
+ *       abort() for a core dump, _exit() with n as status or call vApplicationErrorHook(). Runs in CI should select abort
+ *       or exit, blinking never ends
  */
 void error_blink(const uint8_t n) __attribute__((noreturn));
 
+/**
+ * @brief Print the running task, tick count and time, used by the error reports
+ */
+void print_error_context();
+
 void mcu_shutdown();
 
 /**
  * @brief Get amount of used and free RAM1
  * @return Tuple of: free RAM in byte, used data in byte, used bss in byte, used heap in byte, system free in byte, size of itcm in byte, ram size in byte
+ * @note On the host: free RAM and used heap are those of the port heap (pvPortMalloc()), system free is the available host memory,
+ *       itcm is the size of the program code and ram size is the resident set size of the process
  */
 std::tuple<size_t, size_t, size_t, size_t, size_t, size_t, size_t> ram1_usage();
 
 /**
  * @brief Get amount of used and free RAM2
  * @return Tuple of: free RAM in byte, ram size in byte
+ * @note On the host this is the heap of the host malloc()
  */
 std::tuple<size_t, size_t> ram2_usage();
 
 /**
  * @brief Get amount of used and free external RAM
  * @return Tuple of: free RAM in byte, ram size in byte
+ * @note There is no external RAM on the host, always returns zeros
  */
 std::tuple<size_t, size_t> ram3_usage();
 
 /**
- * @brief Print amount of used and free RAM to Serial
+ * @brief Print amount of used and free RAM and the stack usage of all tasks to Serial
+ * @param[in] json: Print everything as one line of JSON instead of text
+ */
+void print_ram_usage(bool json = false);
+
+/**
+ * @brief Print the utilisation of each (simulated) core and the host CPU it is pinned to to Serial
+ * @param[in] json: Print everything as one line of JSON instead of text
+ * @note Requires configGENERATE_RUN_TIME_STATS and INCLUDE_xTaskGetIdleTaskHandle. A core is busy for the share of the host
+ *       time since the scheduler was started that it ran other tasks than the idle tasks. The host CPU is -1 without
+ *       configUSE_POSIX_CORE_PINNING
  */
-void print_ram_usage();
+void print_core_usage(bool json = false);
 
 /**
  * @brief Get the current time in microseconds
  * @return Current time in us
+ * @note With configUSE_POSIX_VIRTUAL_TIME this is the simulated time since the scheduler was started,
+ *       otherwise it runs faster than real time if the tick period is shortened with vPortSetTickPeriodUs()
+ * @note Integer only and monotonic, with configPOSIX_TIME_CLOCK set to CLOCK_MONOTONIC_COARSE it's cheaper
+ *       but only advances once per host jiffy
+ * @note std::chrono::steady_clock runs on this time as well with virtual time or configPOSIX_SCALED_STEADY_CLOCK (lib/cpp)
  */
 uint64_t get_us();
 
@@ -113,8 +152,20 @@ uint64_t get_us_from_isr();
  */
 uint32_t get_ms();
 
+/**
+ * @brief Print the call stack of a task to Serial
+ * @param[in] task: Handle of the task, nullptr for the calling thread
+ * @note The stack of another task is taken by sending a signal to its thread, the task keeps its state. Function names are
+ *       looked up with dladdr(), so the executable has to be linked with -rdynamic to show its own functions
+ */
 void print_stack_trace(void* task);
 
+/**
+ * @brief Print the call stacks of all tasks to Serial, e.g. to find out where a hung simulation waits
+ * @note Requires configUSE_TRACE_FACILITY, suspends the scheduler while it runs
+ */
+void print_all_stack_traces();
+
 class clock {
     static inline timeval offset_ { 0, 0 };
 
@@ -0,0 +1,359 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FreeRTOS.h"
+
+#if ( configPOSIX_HEAP == 2 )
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "heap_arena.h"
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    #error "configPOSIX_HEAP == 2 requires configSUPPORT_DYNAMIC_ALLOCATION"
+#endif
+/*-----------------------------------------------------------*/
+
+/* Aligned like the host malloc() rather than portBYTE_ALIGNMENT, callers
+ * may store any host type in a block. */
+#define heapALIGNMENT                 ( ( size_t ) 16 )
+#define heapALIGN_UP( x )             ( ( ( x ) + heapALIGNMENT - 1U ) & ~( heapALIGNMENT - 1U ) )
+#define heapSTRUCT_SIZE               heapALIGN_UP( sizeof( BlockLink_t ) )
+#define heapMINIMUM_BLOCK_SIZE        ( heapSTRUCT_SIZE << 1 )
+#define heapBLOCK_ALLOCATED_BITMASK   ( ( ( size_t ) 1 ) << ( ( sizeof( size_t ) * 8U ) - 1U ) )
+#define heapBLOCK_IS_ALLOCATED( pxBlock )    ( ( ( pxBlock )->xBlockSize & heapBLOCK_ALLOCATED_BITMASK ) != 0U )
+
+/* Placed in front of every block, pxNextFreeBlock is only valid while the
+ * block is free. */
+typedef struct A_BLOCK_LINK
+{
+    struct A_BLOCK_LINK * pxNextFreeBlock;
+    size_t xBlockSize;
+} BlockLink_t;
+/*-----------------------------------------------------------*/
+
+static BlockLink_t xStart;
+static BlockLink_t * pxEnd = NULL;
+
+static size_t xFreeBytesRemaining = 0U;
+static size_t xMinimumEverFreeBytesRemaining = 0U;
+static size_t xNumberOfSuccessfulAllocations = 0U;
+static size_t xNumberOfSuccessfulFrees = 0U;
+
+/* Tasks are kept from switching by the critical section, host threads that
+ * call into FreeRTOS by the mutex. */
+static pthread_mutex_t xHeapMutex = PTHREAD_MUTEX_INITIALIZER;
+/*-----------------------------------------------------------*/
+
+static void prvHeapLock( void )
+{
+    portENTER_CRITICAL();
+    pthread_mutex_lock( &xHeapMutex );
+}
+/*-----------------------------------------------------------*/
+
+static void prvHeapUnlock( void )
+{
+    pthread_mutex_unlock( &xHeapMutex );
+    portEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Map the arena and make it one big free block. Called with the lock held.
+ */
+static BaseType_t prvHeapInit( void )
+{
+    const size_t xTotalSize = heapALIGN_UP( configTOTAL_HEAP_SIZE );
+    BlockLink_t * pxFirstFreeBlock;
+    uint8_t * pucArena;
+
+    /* Pages are only backed by host memory once they are touched. */
+    pucArena = mmap( NULL, xTotalSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+    if( pucArena == MAP_FAILED )
+    {
+        return pdFALSE;
+    }
+
+    xStart.pxNextFreeBlock = ( BlockLink_t * ) pucArena;
+    xStart.xBlockSize = 0U;
+
+    /* pxEnd marks the end of the free list and lives at the end of the arena. */
+    pxEnd = ( BlockLink_t * ) ( pucArena + xTotalSize - heapSTRUCT_SIZE );
+    pxEnd->xBlockSize = 0U;
+    pxEnd->pxNextFreeBlock = NULL;
+
+    pxFirstFreeBlock = ( BlockLink_t * ) pucArena;
+    pxFirstFreeBlock->xBlockSize = ( size_t ) ( ( uint8_t * ) pxEnd - pucArena );
+    pxFirstFreeBlock->pxNextFreeBlock = pxEnd;
+
+    xFreeBytesRemaining = pxFirstFreeBlock->xBlockSize;
+    xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+
+    return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Insert a block into the address ordered free list and merge it with the
+ * blocks right before and after it.
+ */
+static void prvInsertBlockIntoFreeList( BlockLink_t * pxBlockToInsert )
+{
+    BlockLink_t * pxIterator;
+
+    for( pxIterator = &xStart; pxIterator->pxNextFreeBlock < pxBlockToInsert; pxIterator = pxIterator->pxNextFreeBlock )
+    {
+        /* Nothing to do here, just iterate to the right position. */
+    }
+
+    if( ( ( uint8_t * ) pxIterator + pxIterator->xBlockSize ) == ( uint8_t * ) pxBlockToInsert )
+    {
+        pxIterator->xBlockSize += pxBlockToInsert->xBlockSize;
+        pxBlockToInsert = pxIterator;
+    }
+
+    if( ( ( uint8_t * ) pxBlockToInsert + pxBlockToInsert->xBlockSize ) == ( uint8_t * ) pxIterator->pxNextFreeBlock )
+    {
+        if( pxIterator->pxNextFreeBlock != pxEnd )
+        {
+            pxBlockToInsert->xBlockSize += pxIterator->pxNextFreeBlock->xBlockSize;
+            pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock->pxNextFreeBlock;
+        }
+        else
+        {
+            pxBlockToInsert->pxNextFreeBlock = pxEnd;
+        }
+    }
+    else
+    {
+        pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock;
+    }
+
+    if( pxIterator != pxBlockToInsert )
+    {
+        pxIterator->pxNextFreeBlock = pxBlockToInsert;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void * pvPortMalloc( size_t xWantedSize )
+{
+    BlockLink_t * pxBlock;
+    BlockLink_t * pxPreviousBlock;
+    void * pvReturn = NULL;
+
+    /* Add the header and keep the next block aligned, reject sizes that
+     * would overflow or reach into the allocated bit. */
+    if( ( xWantedSize > 0U ) && ( xWantedSize < ( heapBLOCK_ALLOCATED_BITMASK - heapSTRUCT_SIZE - heapALIGNMENT ) ) )
+    {
+        xWantedSize = heapALIGN_UP( xWantedSize + heapSTRUCT_SIZE );
+    }
+    else
+    {
+        xWantedSize = 0U;
+    }
+
+    prvHeapLock();
+    {
+        if( ( pxEnd == NULL ) && ( prvHeapInit() == pdFALSE ) )
+        {
+            xWantedSize = 0U;
+        }
+
+        if( ( xWantedSize > 0U ) && ( xWantedSize <= xFreeBytesRemaining ) )
+        {
+            /* First fit, the list is in address order. */
+            pxPreviousBlock = &xStart;
+            pxBlock = xStart.pxNextFreeBlock;
+
+            while( ( pxBlock->xBlockSize < xWantedSize ) && ( pxBlock->pxNextFreeBlock != NULL ) )
+            {
+                pxPreviousBlock = pxBlock;
+                pxBlock = pxBlock->pxNextFreeBlock;
+            }
+
+            if( pxBlock != pxEnd )
+            {
+                pvReturn = ( uint8_t * ) pxBlock + heapSTRUCT_SIZE;
+                pxPreviousBlock->pxNextFreeBlock = pxBlock->pxNextFreeBlock;
+
+                /* Split the block if the remainder is big enough to be
+                 * useful on its own. */
+                if( ( pxBlock->xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+                {
+                    BlockLink_t * pxNewBlockLink = ( BlockLink_t * ) ( ( uint8_t * ) pxBlock + xWantedSize );
+
+                    pxNewBlockLink->xBlockSize = pxBlock->xBlockSize - xWantedSize;
+                    pxBlock->xBlockSize = xWantedSize;
+                    prvInsertBlockIntoFreeList( pxNewBlockLink );
+                }
+
+                xFreeBytesRemaining -= pxBlock->xBlockSize;
+
+                if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+                {
+                    xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+                }
+
+                pxBlock->xBlockSize |= heapBLOCK_ALLOCATED_BITMASK;
+                pxBlock->pxNextFreeBlock = NULL;
+                xNumberOfSuccessfulAllocations++;
+            }
+        }
+
+        traceMALLOC( pvReturn, xWantedSize );
+    }
+    prvHeapUnlock();
+
+    #if ( configUSE_MALLOC_FAILED_HOOK == 1 )
+    {
+        if( pvReturn == NULL )
+        {
+            extern void vApplicationMallocFailedHook( void );
+
+            vApplicationMallocFailedHook();
+        }
+    }
+    #endif
+
+    return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+void * pvPortCalloc( size_t xNum,
+                     size_t xSize )
+{
+    void * pv = NULL;
+
+    if( ( xSize == 0U ) || ( xNum <= SIZE_MAX / xSize ) )
+    {
+        pv = pvPortMalloc( xNum * xSize );
+
+        if( pv != NULL )
+        {
+            memset( pv, 0, xNum * xSize );
+        }
+    }
+
+    return pv;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void * pv )
+{
+    BlockLink_t * pxLink;
+
+    if( pv == NULL )
+    {
+        return;
+    }
+
+    pxLink = ( BlockLink_t * ) ( ( uint8_t * ) pv - heapSTRUCT_SIZE );
+
+    configASSERT( heapBLOCK_IS_ALLOCATED( pxLink ) );
+    configASSERT( pxLink->pxNextFreeBlock == NULL );
+
+    if( heapBLOCK_IS_ALLOCATED( pxLink ) && ( pxLink->pxNextFreeBlock == NULL ) )
+    {
+        pxLink->xBlockSize &= ~heapBLOCK_ALLOCATED_BITMASK;
+
+        prvHeapLock();
+        {
+            xFreeBytesRemaining += pxLink->xBlockSize;
+            traceFREE( pv, pxLink->xBlockSize );
+            prvInsertBlockIntoFreeList( pxLink );
+            xNumberOfSuccessfulFrees++;
+        }
+        prvHeapUnlock();
+    }
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeHeapSize( void )
+{
+    return ( pxEnd != NULL ) ? xFreeBytesRemaining : heapALIGN_UP( configTOTAL_HEAP_SIZE ) - heapSTRUCT_SIZE;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetUsedHeapSize( void )
+{
+    return ( pxEnd != NULL ) ? heapALIGN_UP( configTOTAL_HEAP_SIZE ) - heapSTRUCT_SIZE - xFreeBytesRemaining : 0U;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetMinimumEverFreeHeapSize( void )
+{
+    return ( pxEnd != NULL ) ? xMinimumEverFreeBytesRemaining : xPortGetFreeHeapSize();
+}
+/*-----------------------------------------------------------*/
+
+void vPortInitialiseBlocks( void )
+{
+    /* The arena is set up on the first allocation. */
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapStats( HeapStats_t * pxHeapStats )
+{
+    BlockLink_t * pxBlock;
+    size_t xBlocks = 0U;
+    size_t xMaxSize = 0U;
+    size_t xMinSize = SIZE_MAX;
+
+    prvHeapLock();
+    {
+        if( pxEnd == NULL )
+        {
+            ( void ) prvHeapInit();
+        }
+
+        if( pxEnd != NULL )
+        {
+            for( pxBlock = xStart.pxNextFreeBlock; pxBlock != pxEnd; pxBlock = pxBlock->pxNextFreeBlock )
+            {
+                xBlocks++;
+
+                if( pxBlock->xBlockSize > xMaxSize )
+                {
+                    xMaxSize = pxBlock->xBlockSize;
+                }
+
+                if( pxBlock->xBlockSize < xMinSize )
+                {
+                    xMinSize = pxBlock->xBlockSize;
+                }
+            }
+        }
+
+        pxHeapStats->xSizeOfLargestFreeBlockInBytes = xMaxSize;
+        pxHeapStats->xSizeOfSmallestFreeBlockInBytes = ( xBlocks > 0U ) ? xMinSize : 0U;
+        pxHeapStats->xNumberOfFreeBlocks = xBlocks;
+        pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+        pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+        pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+        pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+    }
+    prvHeapUnlock();
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configPOSIX_HEAP */
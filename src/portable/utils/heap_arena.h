@@ -0,0 +1,42 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bounded heap for the posix port, works like heap_4.c of the kernel.
+ *
+ * Selected with configPOSIX_HEAP == 2. pvPortMalloc() is served from one
+ * arena of configTOTAL_HEAP_SIZE bytes, mapped on the first allocation.
+ * Free blocks are kept in address order and merged with their neighbours,
+ * so fragmentation behaves as on the target. When the arena is exhausted
+ * pvPortMalloc() returns NULL and calls vApplicationMallocFailedHook() if
+ * configUSE_MALLOC_FAILED_HOOK is set.
+ *
+ * xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize() and
+ * vPortGetHeapStats() report the state of the arena. Task stacks take
+ * their configured size from the arena as on the target, although the
+ * task code runs on the stack of its host thread.
+ */
+
+#ifndef HEAP_ARENA_H_
+#define HEAP_ARENA_H_
+
+#ifndef configTOTAL_HEAP_SIZE
+    #define configTOTAL_HEAP_SIZE    ( ( size_t ) ( 512 * 1024 ) )
+#endif
+
+#endif /* HEAP_ARENA_H_ */
@@ -0,0 +1,338 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FreeRTOS.h"
+
+#if ( configPOSIX_HEAP == 1 )
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap_pool.h"
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    #error "configPOSIX_HEAP == 1 requires configSUPPORT_DYNAMIC_ALLOCATION"
+#endif
+/*-----------------------------------------------------------*/
+
+#define heapHEADER_SIZE    ( 16U ) /* keeps the payload aligned like malloc() */
+#define heapLARGE_BLOCK    ( 0xffffffffUL )
+#define heapNUM_POOLS      ( sizeof( xPools ) / sizeof( xPools[ 0 ] ) )
+
+/* Rounded up to keep the header of the next block aligned as well. */
+#define heapPOOL( xObjectSize ) \
+    { ( xObjectSize ), heapHEADER_SIZE + ( ( ( xObjectSize ) + heapHEADER_SIZE - 1U ) & ~( size_t ) ( heapHEADER_SIZE - 1U ) ), 0, 0, { NULL } }
+
+/* Placed in front of every block. */
+typedef struct
+{
+    uint32_t ulPool;  /* pool index or heapLARGE_BLOCK */
+    uint32_t ulIndex; /* block number within the pool */
+    size_t xSize;     /* size of a large block including the header */
+} BlockHeader_t;
+
+typedef struct
+{
+    size_t xObjectSize;
+    size_t xBlockSize;        /* including the header */
+    uint64_t ullHead;         /* ABA tag in the upper half, first free block number + 1 in the lower half */
+    uint32_t ulChunks;
+    uint8_t * pucChunks[ configPOSIX_HEAP_POOL_CHUNKS ];
+} Pool_t;
+
+/* Free blocks store the number of the next free block + 1 in the payload. */
+typedef struct
+{
+    BlockHeader_t xHeader;
+    uint32_t ulNext;
+} FreeBlock_t;
+/*-----------------------------------------------------------*/
+
+/* The Static*_t types have the size of the objects the kernel allocates. */
+static Pool_t xPools[] =
+{
+    heapPOOL( sizeof( StaticTask_t ) ),
+    heapPOOL( sizeof( StaticQueue_t ) ),
+    heapPOOL( sizeof( StaticStreamBuffer_t ) ),
+    heapPOOL( sizeof( StaticEventGroup_t ) ),
+    heapPOOL( sizeof( StaticTimer_t ) )
+};
+static pthread_mutex_t xGrowMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Statistics, updated with relaxed atomics. */
+static size_t xPoolBytes = 0U;      /* all chunks */
+static size_t xPoolUsedBytes = 0U;  /* blocks handed out */
+static size_t xLargeBytes = 0U;     /* fallback blocks handed out */
+/*-----------------------------------------------------------*/
+
+static inline FreeBlock_t * prvGetBlock( const Pool_t * pxPool,
+                                         uint32_t ulIndex )
+{
+    const uint8_t * pucChunk = __atomic_load_n( &pxPool->pucChunks[ ulIndex / configPOSIX_HEAP_POOL_BLOCKS ], __ATOMIC_ACQUIRE );
+
+    return ( FreeBlock_t * ) ( pucChunk + ( size_t ) ( ulIndex % configPOSIX_HEAP_POOL_BLOCKS ) * pxPool->xBlockSize );
+}
+/*-----------------------------------------------------------*/
+
+static Pool_t * prvFindPool( size_t xSize )
+{
+    Pool_t * pxBest = NULL;
+    size_t x;
+
+    for( x = 0; x < heapNUM_POOLS; x++ )
+    {
+        if( ( xSize <= xPools[ x ].xObjectSize ) &&
+            ( ( pxBest == NULL ) || ( xPools[ x ].xObjectSize < pxBest->xObjectSize ) ) )
+        {
+            pxBest = &xPools[ x ];
+        }
+    }
+
+    return pxBest;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Push a chain of blocks, linked through ulNext, whose first block is
+ * ulFirst and whose last block is pxLast.
+ */
+static void prvPush( Pool_t * pxPool,
+                     uint32_t ulFirst,
+                     FreeBlock_t * pxLast )
+{
+    uint64_t ullHead = __atomic_load_n( &pxPool->ullHead, __ATOMIC_RELAXED );
+    uint64_t ullNewHead;
+
+    do
+    {
+        __atomic_store_n( &pxLast->ulNext, ( uint32_t ) ullHead, __ATOMIC_RELAXED );
+        ullNewHead = ( ( ( ullHead >> 32 ) + 1U ) << 32 ) | ( uint64_t ) ( ulFirst + 1U );
+    } while( __atomic_compare_exchange_n( &pxPool->ullHead, &ullHead, ullNewHead, pdFALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static FreeBlock_t * prvPop( Pool_t * pxPool )
+{
+    uint64_t ullHead = __atomic_load_n( &pxPool->ullHead, __ATOMIC_ACQUIRE );
+    uint64_t ullNewHead;
+    FreeBlock_t * pxBlock;
+
+    do
+    {
+        if( ( uint32_t ) ullHead == 0U )
+        {
+            return NULL;
+        }
+
+        /* The block may be taken by another thread meanwhile, then ulNext
+         * is garbage, but the tag makes the exchange fail. Chunks are never
+         * freed, so the read itself is safe. */
+        pxBlock = prvGetBlock( pxPool, ( uint32_t ) ullHead - 1U );
+        ullNewHead = ( ( ( ullHead >> 32 ) + 1U ) << 32 ) | ( uint64_t ) __atomic_load_n( &pxBlock->ulNext, __ATOMIC_RELAXED );
+    } while( __atomic_compare_exchange_n( &pxPool->ullHead, &ullHead, ullNewHead, pdFALSE, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ) == 0 );
+
+    return pxBlock;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Add a chunk of blocks to the pool, returns pdFALSE if the pool has
+ * reached configPOSIX_HEAP_POOL_CHUNKS or the host is out of memory.
+ */
+static BaseType_t prvGrow( Pool_t * pxPool )
+{
+    BaseType_t xReturn = pdTRUE;
+    uint8_t * pucChunk;
+    uint32_t ulFirst;
+    uint32_t x;
+
+    portENTER_CRITICAL();
+    pthread_mutex_lock( &xGrowMutex );
+
+    /* Another thread may have grown the pool in the meantime. */
+    if( ( uint32_t ) __atomic_load_n( &pxPool->ullHead, __ATOMIC_ACQUIRE ) == 0U )
+    {
+        pucChunk = ( pxPool->ulChunks < configPOSIX_HEAP_POOL_CHUNKS ) ? malloc( pxPool->xBlockSize * configPOSIX_HEAP_POOL_BLOCKS ) : NULL;
+
+        if( pucChunk != NULL )
+        {
+            ulFirst = pxPool->ulChunks * configPOSIX_HEAP_POOL_BLOCKS;
+
+            for( x = 0; x < configPOSIX_HEAP_POOL_BLOCKS; x++ )
+            {
+                FreeBlock_t * pxBlock = ( FreeBlock_t * ) ( pucChunk + x * pxPool->xBlockSize );
+
+                pxBlock->xHeader.ulPool = ( uint32_t ) ( pxPool - xPools );
+                pxBlock->xHeader.ulIndex = ulFirst + x;
+                pxBlock->ulNext = ulFirst + x + 2U;
+            }
+
+            __atomic_store_n( &pxPool->pucChunks[ pxPool->ulChunks ], pucChunk, __ATOMIC_RELEASE );
+            pxPool->ulChunks++;
+            __atomic_fetch_add( &xPoolBytes, pxPool->xBlockSize * configPOSIX_HEAP_POOL_BLOCKS, __ATOMIC_RELAXED );
+
+            prvPush( pxPool, ulFirst, ( FreeBlock_t * ) ( pucChunk + ( configPOSIX_HEAP_POOL_BLOCKS - 1U ) * pxPool->xBlockSize ) );
+        }
+        else
+        {
+            xReturn = pdFALSE;
+        }
+    }
+
+    pthread_mutex_unlock( &xGrowMutex );
+    portEXIT_CRITICAL();
+
+    return xReturn;
+}
+/*-----------------------------------------------------------*/
+
+void * pvPortMalloc( size_t xWantedSize )
+{
+    Pool_t * pxPool = prvFindPool( xWantedSize );
+    BlockHeader_t * pxHeader = NULL;
+
+    if( pxPool != NULL )
+    {
+        FreeBlock_t * pxBlock;
+
+        while( ( pxBlock = prvPop( pxPool ) ) == NULL )
+        {
+            if( prvGrow( pxPool ) == pdFALSE )
+            {
+                break;
+            }
+        }
+
+        pxHeader = ( BlockHeader_t * ) pxBlock;
+
+        if( pxHeader != NULL )
+        {
+            __atomic_fetch_add( &xPoolUsedBytes, pxPool->xBlockSize, __ATOMIC_RELAXED );
+        }
+    }
+
+    if( ( pxHeader == NULL ) && ( xWantedSize <= SIZE_MAX - heapHEADER_SIZE ) )
+    {
+        /* The host malloc() is not reentrant, a task must not be switched
+         * out while it holds the malloc lock. */
+        portENTER_CRITICAL();
+        pxHeader = malloc( xWantedSize + heapHEADER_SIZE );
+        portEXIT_CRITICAL();
+
+        if( pxHeader != NULL )
+        {
+            pxHeader->ulPool = heapLARGE_BLOCK;
+            pxHeader->xSize = xWantedSize + heapHEADER_SIZE;
+            __atomic_fetch_add( &xLargeBytes, pxHeader->xSize, __ATOMIC_RELAXED );
+        }
+    }
+
+    if( pxHeader == NULL )
+    {
+        traceMALLOC( NULL, xWantedSize );
+
+        #if ( configUSE_MALLOC_FAILED_HOOK == 1 )
+        {
+            extern void vApplicationMallocFailedHook( void );
+
+            vApplicationMallocFailedHook();
+        }
+        #endif
+
+        return NULL;
+    }
+
+    traceMALLOC( ( uint8_t * ) pxHeader + heapHEADER_SIZE, xWantedSize );
+
+    return ( uint8_t * ) pxHeader + heapHEADER_SIZE;
+}
+/*-----------------------------------------------------------*/
+
+void * pvPortCalloc( size_t xNum,
+                     size_t xSize )
+{
+    void * pv = NULL;
+
+    if( ( xSize == 0 ) || ( xNum <= SIZE_MAX / xSize ) )
+    {
+        pv = pvPortMalloc( xNum * xSize );
+
+        if( pv != NULL )
+        {
+            memset( pv, 0, xNum * xSize );
+        }
+    }
+
+    return pv;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void * pv )
+{
+    BlockHeader_t * pxHeader;
+
+    if( pv == NULL )
+    {
+        return;
+    }
+
+    pxHeader = ( BlockHeader_t * ) ( ( uint8_t * ) pv - heapHEADER_SIZE );
+    traceFREE( pv, 0 );
+
+    if( pxHeader->ulPool == heapLARGE_BLOCK )
+    {
+        __atomic_fetch_sub( &xLargeBytes, pxHeader->xSize, __ATOMIC_RELAXED );
+
+        portENTER_CRITICAL();
+        free( pxHeader );
+        portEXIT_CRITICAL();
+    }
+    else
+    {
+        configASSERT( pxHeader->ulPool < heapNUM_POOLS );
+        __atomic_fetch_sub( &xPoolUsedBytes, xPools[ pxHeader->ulPool ].xBlockSize, __ATOMIC_RELAXED );
+        prvPush( &xPools[ pxHeader->ulPool ], pxHeader->ulIndex, ( FreeBlock_t * ) pxHeader );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Free blocks held by the pools, the host heap behind the fallback is not
+ * included.
+ */
+size_t xPortGetFreeHeapSize( void )
+{
+    return __atomic_load_n( &xPoolBytes, __ATOMIC_RELAXED ) - __atomic_load_n( &xPoolUsedBytes, __ATOMIC_RELAXED );
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetUsedHeapSize( void )
+{
+    return __atomic_load_n( &xPoolUsedBytes, __ATOMIC_RELAXED ) + __atomic_load_n( &xLargeBytes, __ATOMIC_RELAXED );
+}
+/*-----------------------------------------------------------*/
+
+void vPortInitialiseBlocks( void )
+{
+    /* The pools are initialised statically, so they can be used by
+     * constructors as well. */
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configPOSIX_HEAP */
@@ -0,0 +1,49 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Size class pools behind pvPortMalloc() / vPortFree() for the posix port.
+ *
+ * Selected with configPOSIX_HEAP == 1. There is one pool for each kernel
+ * object the kernel allocates dynamically (task control block, queue /
+ * semaphore / mutex, stream buffer, event group and timer), the block size
+ * of a pool is the size of the matching Static*_t type. A request is
+ * served from the smallest pool it fits into, anything larger (stacks,
+ * queue storage) goes to the host malloc() as before.
+ *
+ * The free list of a pool is a lock free stack, taking or returning a
+ * block neither blocks signals nor takes a lock. Only growing a pool by
+ * another chunk of configPOSIX_HEAP_POOL_BLOCKS blocks and the large
+ * fallback run in a critical section. Memory of a pool is never returned
+ * to the host, and ASan or valgrind can't see a use after free or an
+ * overflow of a pool block. That's why the default stays the host
+ * malloc() (configPOSIX_HEAP == 0), projects opt in to the pools.
+ */
+
+#ifndef HEAP_POOL_H_
+#define HEAP_POOL_H_
+
+#ifndef configPOSIX_HEAP_POOL_BLOCKS
+    #define configPOSIX_HEAP_POOL_BLOCKS    ( 64U ) /* blocks per chunk */
+#endif
+
+#ifndef configPOSIX_HEAP_POOL_CHUNKS
+    #define configPOSIX_HEAP_POOL_CHUNKS    ( 256U ) /* chunks per pool, further requests use the fallback */
+#endif
+
+#endif /* HEAP_POOL_H_ */
@@ -0,0 +1,424 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include "FreeRTOS.h"
+
+#if ( configUSE_POSIX_PROFILER == 1 )
+
+#ifndef __linux__
+    #error "configUSE_POSIX_PROFILER is only supported on Linux"
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unwind.h>
+
+#include "profiler.h"
+
+#ifndef sigev_notify_thread_id
+    #define sigev_notify_thread_id    _sigev_un._tid
+#endif
+
+#define profilerSKIP_FRAMES    ( 2U ) /* prvProfilerHandler() and the signal trampoline */
+#define profilerMAX_TASKS      ( 256U )
+/*-----------------------------------------------------------*/
+
+typedef struct PROFILER_SAMPLE
+{
+    const void * pvTask;
+    uint32_t ulDepth; /* 0 until the sample is complete */
+    void * pvFrames[ configPOSIX_PROFILER_DEPTH ];
+} ProfilerSample_t;
+
+typedef struct PROFILER_TASK
+{
+    const void * pvTask;
+    char acName[ configMAX_TASK_NAME_LEN ];
+} ProfilerTask_t;
+
+typedef struct PROFILER_UNWIND
+{
+    void ** ppvFrames;
+    uint32_t ulDepth;
+    uint32_t ulSkip;
+} ProfilerUnwind_t;
+
+/* Optional, only there if the C++ runtime is linked. */
+extern char * __cxa_demangle( const char * pcMangled,
+                              char * pcBuffer,
+                              size_t * pxLength,
+                              int * piStatus ) __attribute__( ( weak ) );
+
+static ProfilerSample_t * pxProfilerSamples = NULL;
+static uint64_t ullProfilerNext = 0; /* next free sample, counts lost samples as well */
+
+/* Only written by a task thread before it runs, so no other task does. */
+static ProfilerTask_t xProfilerTasks[ profilerMAX_TASKS ];
+static uint32_t ulProfilerTasks = 0;
+
+static char acProfilerPath[ 256 ];
+/*-----------------------------------------------------------*/
+
+static _Unwind_Reason_Code prvProfilerFrame( struct _Unwind_Context * pxContext,
+                                             void * pvUnwind )
+{
+    ProfilerUnwind_t * pxUnwind = pvUnwind;
+    void * pvPc = ( void * ) _Unwind_GetIP( pxContext );
+
+    if( pxUnwind->ulSkip > 0U )
+    {
+        pxUnwind->ulSkip--;
+        return _URC_NO_REASON;
+    }
+
+    if( ( pvPc == NULL ) || ( pxUnwind->ulDepth >= configPOSIX_PROFILER_DEPTH ) )
+    {
+        return _URC_END_OF_STACK;
+    }
+
+    pxUnwind->ppvFrames[ pxUnwind->ulDepth++ ] = pvPc;
+
+    return _URC_NO_REASON;
+}
+/*-----------------------------------------------------------*/
+
+static void prvProfilerHandler( int iSig,
+                                siginfo_t * pxInfo,
+                                void * pvContext )
+{
+    ProfilerUnwind_t xUnwind;
+    ProfilerSample_t * pxSample;
+    uint64_t ullIndex;
+    int iSavedErrno = errno;
+
+    ( void ) iSig;
+    ( void ) pvContext;
+
+    if( pxInfo->si_code != SI_TIMER )
+    {
+        return;
+    }
+
+    ullIndex = __atomic_fetch_add( &ullProfilerNext, 1U, __ATOMIC_RELAXED );
+
+    if( ullIndex < configPOSIX_PROFILER_SAMPLES )
+    {
+        pxSample = &pxProfilerSamples[ ullIndex ];
+        pxSample->pvTask = pxInfo->si_value.sival_ptr;
+
+        xUnwind.ppvFrames = pxSample->pvFrames;
+        xUnwind.ulDepth = 0U;
+        xUnwind.ulSkip = profilerSKIP_FRAMES;
+        ( void ) _Unwind_Backtrace( prvProfilerFrame, &xUnwind );
+
+        __atomic_store_n( &pxSample->ulDepth, xUnwind.ulDepth, __ATOMIC_RELEASE );
+    }
+
+    errno = iSavedErrno;
+}
+/*-----------------------------------------------------------*/
+
+int iProfilerStartTask( const void * pvTask,
+                        const char * pcName,
+                        timer_t * pxTimer )
+{
+    struct sigevent xEvent;
+    struct itimerspec xInterval;
+    uint32_t ulTask;
+
+    if( pxProfilerSamples == NULL )
+    {
+        return -1;
+    }
+
+    /* A new task may reuse the handle of a deleted one. */
+    for( ulTask = 0U; ( ulTask < ulProfilerTasks ) && ( xProfilerTasks[ ulTask ].pvTask != pvTask ); ulTask++ )
+    {
+    }
+
+    if( ulTask < profilerMAX_TASKS )
+    {
+        xProfilerTasks[ ulTask ].pvTask = pvTask;
+        strncpy( xProfilerTasks[ ulTask ].acName, pcName, sizeof( xProfilerTasks[ ulTask ].acName ) - 1U );
+        __atomic_store_n( &ulProfilerTasks, ( ulTask == ulProfilerTasks ) ? ulTask + 1U : ulProfilerTasks, __ATOMIC_RELEASE );
+    }
+
+    memset( &xEvent, 0, sizeof( xEvent ) );
+    xEvent.sigev_notify = SIGEV_THREAD_ID;
+    xEvent.sigev_signo = SIGPROF;
+    xEvent.sigev_value.sival_ptr = ( void * ) pvTask;
+    xEvent.sigev_notify_thread_id = ( pid_t ) syscall( SYS_gettid );
+
+    if( timer_create( CLOCK_THREAD_CPUTIME_ID, &xEvent, pxTimer ) != 0 )
+    {
+        return -1;
+    }
+
+    xInterval.it_value.tv_sec = configPOSIX_PROFILER_INTERVAL_US / 1000000UL;
+    xInterval.it_value.tv_nsec = ( configPOSIX_PROFILER_INTERVAL_US % 1000000UL ) * 1000UL;
+    xInterval.it_interval = xInterval.it_value;
+
+    if( timer_settime( *pxTimer, 0, &xInterval, NULL ) != 0 )
+    {
+        timer_delete( *pxTimer );
+        return -1;
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+void vProfilerStopTask( timer_t xTimer )
+{
+    timer_delete( xTimer );
+}
+/*-----------------------------------------------------------*/
+
+static int prvProfilerCompare( const void * pvA,
+                               const void * pvB )
+{
+    const ProfilerSample_t * pxA = *( const ProfilerSample_t * const * ) pvA;
+    const ProfilerSample_t * pxB = *( const ProfilerSample_t * const * ) pvB;
+
+    if( pxA->pvTask != pxB->pvTask )
+    {
+        return ( ( uintptr_t ) pxA->pvTask < ( uintptr_t ) pxB->pvTask ) ? -1 : 1;
+    }
+
+    if( pxA->ulDepth != pxB->ulDepth )
+    {
+        return ( pxA->ulDepth < pxB->ulDepth ) ? -1 : 1;
+    }
+
+    return memcmp( pxA->pvFrames, pxB->pvFrames, pxA->ulDepth * sizeof( pxA->pvFrames[ 0 ] ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvProfilerWriteTask( FILE * pxFile,
+                                  const void * pvTask )
+{
+    uint32_t ulTask;
+    const uint32_t ulTasks = __atomic_load_n( &ulProfilerTasks, __ATOMIC_ACQUIRE );
+
+    for( ulTask = 0U; ulTask < ulTasks; ulTask++ )
+    {
+        if( xProfilerTasks[ ulTask ].pvTask == pvTask )
+        {
+            fprintf( pxFile, "%.*s", ( int ) sizeof( xProfilerTasks[ ulTask ].acName ), xProfilerTasks[ ulTask ].acName );
+            return;
+        }
+    }
+
+    fprintf( pxFile, "task@%p", pvTask );
+}
+/*-----------------------------------------------------------*/
+
+static void prvProfilerWriteFrame( FILE * pxFile,
+                                   void * pvPc )
+{
+    Dl_info xInfo;
+    const char * pcModule;
+    char * pcDemangled = NULL;
+    int iStatus = -1;
+
+    /* A return address may already belong to the next function. */
+    if( ( dladdr( ( char * ) pvPc - 1, &xInfo ) == 0 ) || ( xInfo.dli_fname == NULL ) )
+    {
+        fprintf( pxFile, "%p", pvPc );
+        return;
+    }
+
+    pcModule = strrchr( xInfo.dli_fname, '/' );
+    pcModule = ( pcModule != NULL ) ? pcModule + 1 : xInfo.dli_fname;
+
+    if( xInfo.dli_sname == NULL )
+    {
+        fprintf( pxFile, "%s+0x%lx", pcModule, ( unsigned long ) ( ( char * ) pvPc - ( char * ) xInfo.dli_fbase ) );
+        return;
+    }
+
+    if( __cxa_demangle != NULL )
+    {
+        pcDemangled = __cxa_demangle( xInfo.dli_sname, NULL, NULL, &iStatus );
+    }
+
+    fputs( ( iStatus == 0 ) ? pcDemangled : xInfo.dli_sname, pxFile );
+    free( pcDemangled );
+}
+/*-----------------------------------------------------------*/
+
+int iProfilerWrite( const char * pcPath )
+{
+    const ProfilerSample_t ** ppxSorted;
+    uint64_t ullTaken;
+    size_t xSamples = 0U;
+    size_t xIndex;
+    size_t xCount;
+    int32_t lFrame;
+    sigset_t xAllSignals;
+    sigset_t xSavedSignals;
+    FILE * pxFile;
+
+    if( pxProfilerSamples == NULL )
+    {
+        return -1;
+    }
+
+    ullTaken = __atomic_load_n( &ullProfilerNext, __ATOMIC_RELAXED );
+
+    if( ullTaken > configPOSIX_PROFILER_SAMPLES )
+    {
+        fprintf( stderr, "profiler: buffer full, %llu samples lost\n", ( unsigned long long ) ( ullTaken - configPOSIX_PROFILER_SAMPLES ) );
+        ullTaken = configPOSIX_PROFILER_SAMPLES;
+    }
+
+    /* Called from a task, so don't get switched away while the host heap
+     * and stdio are used. */
+    sigfillset( &xAllSignals );
+    sigdelset( &xAllSignals, SIGPROF );
+    pthread_sigmask( SIG_BLOCK, &xAllSignals, &xSavedSignals );
+
+    ppxSorted = malloc( ( size_t ) ullTaken * sizeof( *ppxSorted ) + 1U );
+    pxFile = fopen( pcPath, "w" );
+
+    if( ( ppxSorted == NULL ) || ( pxFile == NULL ) )
+    {
+        free( ppxSorted );
+
+        if( pxFile != NULL )
+        {
+            fclose( pxFile );
+        }
+
+        pthread_sigmask( SIG_SETMASK, &xSavedSignals, NULL );
+        return -1;
+    }
+
+    for( xIndex = 0U; xIndex < ( size_t ) ullTaken; xIndex++ )
+    {
+        /* Skip samples still being written and those without a stack. */
+        if( __atomic_load_n( &pxProfilerSamples[ xIndex ].ulDepth, __ATOMIC_ACQUIRE ) != 0U )
+        {
+            ppxSorted[ xSamples++ ] = &pxProfilerSamples[ xIndex ];
+        }
+    }
+
+    qsort( ppxSorted, xSamples, sizeof( *ppxSorted ), prvProfilerCompare );
+
+    for( xIndex = 0U; xIndex < xSamples; xIndex += xCount )
+    {
+        const ProfilerSample_t * pxSample = ppxSorted[ xIndex ];
+
+        for( xCount = 1U; ( xIndex + xCount < xSamples ) && ( prvProfilerCompare( &ppxSorted[ xIndex ], &ppxSorted[ xIndex + xCount ] ) == 0 ); xCount++ )
+        {
+        }
+
+        /* Root first: task name, then the outermost frame. */
+        prvProfilerWriteTask( pxFile, pxSample->pvTask );
+
+        for( lFrame = ( int32_t ) pxSample->ulDepth - 1; lFrame >= 0; lFrame-- )
+        {
+            fputc( ';', pxFile );
+            prvProfilerWriteFrame( pxFile, pxSample->pvFrames[ lFrame ] );
+        }
+
+        fprintf( pxFile, " %lu\n", ( unsigned long ) xCount );
+    }
+
+    fclose( pxFile );
+    free( ppxSorted );
+    pthread_sigmask( SIG_SETMASK, &xSavedSignals, NULL );
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+void vProfilerFlush( void )
+{
+    if( ( pxProfilerSamples != NULL ) && ( iProfilerWrite( acProfilerPath ) == 0 ) )
+    {
+        fprintf( stderr, "profiler: samples written to %s\n", acProfilerPath );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvProfilerAtExit( void )
+{
+    vProfilerFlush();
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Set up the buffer and the handler before main() runs, tasks created
+ * before the scheduler is started are profiled as well. Without a file
+ * configured the profiler stays disabled and no task gets a timer.
+ */
+static void __attribute__( ( constructor ) ) prvProfilerInit( void )
+{
+    const char * pcPath = getenv( "FREERTOS_PROFILE_FILE" );
+    struct sigaction xAction;
+
+    if( ( pcPath != NULL ) && ( pcPath[ 0 ] != '\0' ) )
+    {
+        snprintf( acProfilerPath, sizeof( acProfilerPath ), "%s", pcPath );
+    }
+    else
+    {
+        #ifdef configPOSIX_PROFILER_FILE_PATTERN
+            snprintf( acProfilerPath, sizeof( acProfilerPath ), configPOSIX_PROFILER_FILE_PATTERN, ( int ) getpid() );
+        #else
+            return;
+        #endif
+    }
+
+    /* Pages are only touched when samples are taken. */
+    pxProfilerSamples = calloc( configPOSIX_PROFILER_SAMPLES, sizeof( ProfilerSample_t ) );
+
+    if( pxProfilerSamples == NULL )
+    {
+        return;
+    }
+
+    memset( &xAction, 0, sizeof( xAction ) );
+    xAction.sa_flags = SA_SIGINFO | SA_RESTART;
+    xAction.sa_sigaction = prvProfilerHandler;
+    sigfillset( &xAction.sa_mask );
+
+    if( sigaction( SIGPROF, &xAction, NULL ) != 0 )
+    {
+        free( pxProfilerSamples );
+        pxProfilerSamples = NULL;
+        return;
+    }
+
+    atexit( prvProfilerAtExit );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_PROFILER */
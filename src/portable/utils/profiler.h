@@ -0,0 +1,89 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sampling profiler for the posix port, Linux only.
+ *
+ * Enabled with configUSE_POSIX_PROFILER == 1. Every task thread gets a
+ * timer on its own CPU time clock (CLOCK_THREAD_CPUTIME_ID) that raises
+ * SIGPROF after each configPOSIX_PROFILER_INTERVAL_US of CPU time used,
+ * so blocked tasks don't produce samples. The handler stores the call
+ * stack and the task handle into a preallocated buffer, claiming a slot
+ * with one atomic increment. SIGPROF is not blocked by critical sections,
+ * so the time spent with interrupts disabled is seen where it is spent.
+ * When the buffer is full, further samples are counted as lost.
+ *
+ * At exit the samples are written in the collapsed stack format of
+ * flamegraph.pl, one line per distinct stack with the name of the task as
+ * root frame. The file name is taken from the environment variable
+ * FREERTOS_PROFILE_FILE. If it isn't set, configPOSIX_PROFILER_FILE_PATTERN
+ * is used with the process id, but only if the project defines it. Without
+ * either the profiler stays disabled: no buffer, no SIGPROF handler and no
+ * file. Function names are looked up with dladdr(), link with -rdynamic to
+ * see the functions of the executable.
+ *
+ * exit() and returning from main() write the file with an atexit()
+ * handler. The error policies of freertos::error_blink() call
+ * vProfilerFlush() themselves; an application that ends with _exit() or
+ * abort() has to call it before.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifndef configPOSIX_PROFILER_INTERVAL_US
+    #define configPOSIX_PROFILER_INTERVAL_US    ( 1000UL ) /* CPU time between two samples of a task */
+#endif
+
+#ifndef configPOSIX_PROFILER_SAMPLES
+    #define configPOSIX_PROFILER_SAMPLES    ( 65536UL )
+#endif
+
+#ifndef configPOSIX_PROFILER_DEPTH
+    #define configPOSIX_PROFILER_DEPTH    ( 32U ) /* frames per sample */
+#endif
+
+/* Called by the port on the thread of a task before it runs for the first
+ * time. Returns 0 if a timer was created and stored in pxTimer. */
+int iProfilerStartTask( const void * pvTask,
+                        const char * pcName,
+                        timer_t * pxTimer );
+
+/* Called by the port when the thread of a task is gone. */
+void vProfilerStopTask( timer_t xTimer );
+
+/* Write the samples taken so far in collapsed stack format, they are kept.
+ * Returns 0 on success. */
+int iProfilerWrite( const char * pcPath );
+
+/* Write the samples taken so far to the configured file, like at exit.
+ * Does nothing if the profiler is disabled. */
+void vProfilerFlush( void );
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* PROFILER_H_ */
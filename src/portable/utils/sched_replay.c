@@ -0,0 +1,242 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FreeRTOS.h"
+
+#if ( configUSE_POSIX_SCHED_REPLAY == 1 )
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sched_replay.h"
+
+#if ( configUSE_POSIX_VIRTUAL_TIME == 1 )
+    #error "configUSE_POSIX_SCHED_REPLAY is not needed with configUSE_POSIX_VIRTUAL_TIME, which is deterministic already"
+#endif
+/*-----------------------------------------------------------*/
+
+/* All functions are called with interrupts disabled by the one thread that
+ * runs FreeRTOS code at that time, so no further locking is needed. */
+static int iRecordFd = -1;
+static SchedReplayRecord_t * pxReplay = NULL;
+static size_t xReplayLength = 0;
+static size_t xReplayIndex = 0;
+static BaseType_t xReplaying = pdFALSE;
+static uint64_t ullPosition = 0; /* replay points passed */
+static uint64_t ullTicks = 0;
+/*-----------------------------------------------------------*/
+
+static void prvReplayStop( const char * pcReason,
+                           const SchedReplayRecord_t * pxActual )
+{
+    char acMessage[ 256 ];
+    int iLength;
+
+    if( pxActual != NULL )
+    {
+        const SchedReplayRecord_t * pxExpected = &pxReplay[ xReplayIndex ];
+
+        iLength = snprintf( acMessage, sizeof( acMessage ),
+                            "sched replay: %s at record %lu: expected event %u task %u position %llu value %llu, got event %u task %u position %llu value %llu\n",
+                            pcReason, ( unsigned long ) xReplayIndex,
+                            ( unsigned ) pxExpected->ulEvent, ( unsigned ) pxExpected->ulTask,
+                            ( unsigned long long ) pxExpected->ullPosition, ( unsigned long long ) pxExpected->ullValue,
+                            ( unsigned ) pxActual->ulEvent, ( unsigned ) pxActual->ulTask,
+                            ( unsigned long long ) pxActual->ullPosition, ( unsigned long long ) pxActual->ullValue );
+    }
+    else
+    {
+        iLength = snprintf( acMessage, sizeof( acMessage ), "sched replay: %s after %lu records\n",
+                            pcReason, ( unsigned long ) xReplayIndex );
+    }
+
+    /* Called from the tick handler, so no stdio. */
+    if( iLength > 0 )
+    {
+        ( void ) !write( STDERR_FILENO, acMessage, ( size_t ) iLength );
+    }
+
+    xReplaying = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static void prvReplayEvent( const SchedReplayRecord_t * pxRecord )
+{
+    if( iRecordFd >= 0 )
+    {
+        ( void ) !write( iRecordFd, pxRecord, sizeof( *pxRecord ) );
+    }
+
+    if( xReplaying == pdFALSE )
+    {
+        return;
+    }
+
+    if( memcmp( &pxReplay[ xReplayIndex ], pxRecord, sizeof( *pxRecord ) ) != 0 )
+    {
+        prvReplayStop( "diverged", pxRecord );
+        return;
+    }
+
+    if( ++xReplayIndex == xReplayLength )
+    {
+        prvReplayStop( "finished", NULL );
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xSchedReplayIsReplaying( void )
+{
+    return xReplaying;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xSchedReplayTickDue( uint32_t ulTask )
+{
+    const SchedReplayRecord_t * pxNext;
+
+    if( xReplaying == pdFALSE )
+    {
+        return pdFALSE;
+    }
+
+    pxNext = &pxReplay[ xReplayIndex ];
+
+    if( ( pxNext->ulEvent != eSchedReplayTICK ) || ( pxNext->ullPosition != ullPosition ) )
+    {
+        return pdFALSE;
+    }
+
+    if( pxNext->ulTask != ulTask )
+    {
+        SchedReplayRecord_t xActual = { eSchedReplayTICK, ulTask, ullPosition, 0 };
+
+        prvReplayStop( "tick hits another task", &xActual );
+        return pdFALSE;
+    }
+
+    return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xSchedReplayPoint( uint32_t ulTask )
+{
+    ullPosition++;
+
+    if( ( xReplaying != pdFALSE ) &&
+        ( pxReplay[ xReplayIndex ].ulEvent == eSchedReplayTICK ) &&
+        ( pxReplay[ xReplayIndex ].ullPosition < ullPosition ) )
+    {
+        SchedReplayRecord_t xActual = { eSchedReplayTICK, ulTask, ullPosition, 0 };
+
+        prvReplayStop( "tick missed", &xActual );
+    }
+
+    return xSchedReplayTickDue( ulTask );
+}
+/*-----------------------------------------------------------*/
+
+void vSchedReplayTick( uint32_t ulTask )
+{
+    SchedReplayRecord_t xRecord = { eSchedReplayTICK, ulTask, ullPosition, ++ullTicks };
+
+    prvReplayEvent( &xRecord );
+}
+/*-----------------------------------------------------------*/
+
+void vSchedReplaySwitch( uint32_t ulFrom,
+                         uint32_t ulTo )
+{
+    SchedReplayRecord_t xRecord = { eSchedReplaySWITCH, ulTo, ullPosition, ulFrom };
+
+    prvReplayEvent( &xRecord );
+}
+/*-----------------------------------------------------------*/
+
+static void prvReplayLoad( const char * pcPath )
+{
+    SchedReplayHeader_t xHeader;
+    struct stat xStat;
+    size_t xSize;
+    int iFd = open( pcPath, O_RDONLY );
+
+    if( iFd < 0 )
+    {
+        fprintf( stderr, "sched replay: can't open %s\n", pcPath );
+        return;
+    }
+
+    if( ( fstat( iFd, &xStat ) != 0 ) ||
+        ( read( iFd, &xHeader, sizeof( xHeader ) ) != ( ssize_t ) sizeof( xHeader ) ) ||
+        ( memcmp( xHeader.acMagic, schedREPLAY_MAGIC, sizeof( xHeader.acMagic ) ) != 0 ) ||
+        ( xHeader.ulVersion != schedREPLAY_VERSION ) ||
+        ( xHeader.ulRecordSize != sizeof( SchedReplayRecord_t ) ) )
+    {
+        fprintf( stderr, "sched replay: %s is not a schedule log\n", pcPath );
+        close( iFd );
+        return;
+    }
+
+    xSize = ( size_t ) xStat.st_size - sizeof( xHeader );
+    xReplayLength = xSize / sizeof( SchedReplayRecord_t );
+    pxReplay = malloc( xSize );
+
+    if( ( xReplayLength > 0 ) && ( pxReplay != NULL ) &&
+        ( read( iFd, pxReplay, xSize ) == ( ssize_t ) xSize ) )
+    {
+        xReplaying = pdTRUE;
+    }
+
+    close( iFd );
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Select the mode before main() runs, tasks created before the scheduler
+ * is started take part in the log as well.
+ */
+static void __attribute__( ( constructor ) ) prvSchedReplayInit( void )
+{
+    const char * pcReplay = getenv( "FREERTOS_SCHED_REPLAY" );
+    const char * pcRecord = getenv( "FREERTOS_SCHED_RECORD" );
+
+    if( ( pcReplay != NULL ) && ( pcReplay[ 0 ] != '\0' ) )
+    {
+        prvReplayLoad( pcReplay );
+    }
+
+    if( ( pcRecord != NULL ) && ( pcRecord[ 0 ] != '\0' ) )
+    {
+        SchedReplayHeader_t xHeader = { schedREPLAY_MAGIC, schedREPLAY_VERSION, sizeof( SchedReplayRecord_t ) };
+
+        iRecordFd = open( pcRecord, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+        if( ( iRecordFd >= 0 ) && ( write( iRecordFd, &xHeader, sizeof( xHeader ) ) != ( ssize_t ) sizeof( xHeader ) ) )
+        {
+            close( iRecordFd );
+            iRecordFd = -1;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_SCHED_REPLAY */
@@ -0,0 +1,112 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Record and replay of scheduling decisions for the posix port.
+ *
+ * Enabled with configUSE_POSIX_SCHED_REPLAY == 1, the mode is selected at
+ * run time:
+ *
+ * - FREERTOS_SCHED_RECORD=<file> logs every tick interrupt and every
+ *   task switch.
+ * - FREERTOS_SCHED_REPLAY=<file> runs the application again with the
+ *   ticks of a recorded log instead of the tick thread.
+ *
+ * The only source of non-determinism in the port is the point where the
+ * tick interrupt hits the running task. Because only one task thread runs
+ * at a time, the points where a task enables interrupts or suspends the
+ * scheduler form a single sequence over the whole run. The number of
+ * points passed is used as the arrival point of a tick. A replayed tick is
+ * raised when that point is reached again, so it hits the same task
+ * between the same two kernel calls. The idle task has no effects of its
+ * own, its points are not counted and its ticks are raised as soon as it
+ * runs. Task switches follow from the kernel state and are compared with
+ * the log; the replay stops with a message on stderr at the first
+ * difference and the real tick takes over.
+ *
+ * While recording, the tick thread keeps a whole tick period between two
+ * ticks instead of catching up with absolute deadlines, so the tick count
+ * can fall behind freertos::get_us() on a loaded host.
+ *
+ * Tasks are identified by their creation order. Host threads that call
+ * into FreeRTOS and data races in plain task code between two kernel
+ * calls are not covered.
+ */
+
+#ifndef SCHED_REPLAY_H_
+#define SCHED_REPLAY_H_
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define schedREPLAY_MAGIC      "FRTSCHED"
+#define schedREPLAY_VERSION    ( 1UL )
+
+typedef enum
+{
+    eSchedReplayTICK = 1,   /* ulTask: interrupted task, ullValue: number of the tick */
+    eSchedReplaySWITCH      /* ulTask: task switched in, ullValue: task switched out */
+} eSchedReplayEvent;
+
+typedef struct
+{
+    uint32_t ulEvent;
+    uint32_t ulTask;
+    uint64_t ullPosition; /* number of replay points passed so far */
+    uint64_t ullValue;
+} SchedReplayRecord_t;
+
+typedef struct
+{
+    char acMagic[ 8 ];
+    uint32_t ulVersion;
+    uint32_t ulRecordSize;
+} SchedReplayHeader_t;
+
+/*
+ * pdTRUE while a log is replayed, the tick thread must stay quiet.
+ */
+BaseType_t xSchedReplayIsReplaying( void );
+
+/*
+ * Called at each replay point of the running task. Returns pdTRUE if the
+ * next replayed tick is due at this point.
+ */
+BaseType_t xSchedReplayPoint( uint32_t ulTask );
+
+/*
+ * Called when a task resumes inside the tick handler, i.e. without
+ * passing a replay point. Returns pdTRUE like above.
+ */
+BaseType_t xSchedReplayTickDue( uint32_t ulTask );
+
+void vSchedReplayTick( uint32_t ulTask );
+
+void vSchedReplaySwitch( uint32_t ulFrom,
+                         uint32_t ulTo );
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* SCHED_REPLAY_H_ */
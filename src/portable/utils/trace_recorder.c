@@ -0,0 +1,222 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FreeRTOS.h"
+
+#if ( configUSE_POSIX_TRACE_RECORDER == 1 )
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "task.h"
+#include "queue.h"
+#include "trace_recorder.h"
+
+#if ( configUSE_TRACE_FACILITY != 1 )
+    #error "configUSE_POSIX_TRACE_RECORDER requires configUSE_TRACE_FACILITY"
+#endif
+
+#if ( ( configPOSIX_TRACE_BUFFER_RECORDS & ( configPOSIX_TRACE_BUFFER_RECORDS - 1 ) ) != 0 )
+    #error "configPOSIX_TRACE_BUFFER_RECORDS must be a power of two"
+#endif
+/*-----------------------------------------------------------*/
+
+static TraceHeader_t * pxTraceHeader = NULL;
+static TraceRecord_t * pxTraceRecords = NULL;
+/*-----------------------------------------------------------*/
+
+static inline uint64_t prvTraceTimestamp( void )
+{
+    struct timespec t;
+
+    clock_gettime( CLOCK_MONOTONIC, &t );
+
+    return ( uint64_t ) t.tv_sec * ( uint64_t ) 1000000000UL + ( uint64_t ) t.tv_nsec;
+}
+/*-----------------------------------------------------------*/
+
+static inline TraceRecord_t * prvTraceClaimRecord( void )
+{
+    uint64_t ullIndex;
+    TraceRecord_t * pxRecord;
+
+    if( pxTraceHeader == NULL )
+    {
+        return NULL;
+    }
+
+    /* Tasks, the tick signal handler and injected interrupts may all
+     * record concurrently, so slots are claimed atomically. */
+    ullIndex = __atomic_fetch_add( &pxTraceHeader->ullWriteIndex, 1, __ATOMIC_RELAXED );
+    pxRecord = &pxTraceRecords[ ullIndex & ( configPOSIX_TRACE_BUFFER_RECORDS - 1 ) ];
+
+    /* Once the ring has wrapped the slot still holds the record of the
+     * previous lap. Mark it incomplete before any field is overwritten, so
+     * the exporter skips it until the new event is stored last. */
+    __atomic_store_n( &pxRecord->usEvent, 0, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    return pxRecord;
+}
+/*-----------------------------------------------------------*/
+
+void vTraceRecord( eTraceEvent eEvent,
+                   const void * pvObject,
+                   uint32_t ulArg,
+                   uint16_t usFlags )
+{
+    TraceRecord_t * pxRecord = prvTraceClaimRecord();
+
+    if( pxRecord != NULL )
+    {
+        pxRecord->ullTimestamp = prvTraceTimestamp();
+        pxRecord->ullTask = ( uint64_t ) ( uintptr_t ) xTaskGetCurrentTaskHandle();
+        pxRecord->u.xObject.ullObject = ( uint64_t ) ( uintptr_t ) pvObject;
+        pxRecord->u.xObject.ulArg = ulArg;
+        pxRecord->usFlags = usFlags;
+        __atomic_store_n( &pxRecord->usEvent, ( uint16_t ) eEvent, __ATOMIC_RELEASE );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvTraceRecordName( eTraceEvent eEvent,
+                                const void * pvTask,
+                                const char * pcName )
+{
+    TraceRecord_t * pxRecord = prvTraceClaimRecord();
+
+    if( pxRecord != NULL )
+    {
+        pxRecord->ullTimestamp = prvTraceTimestamp();
+        /* The named task is stored instead of the running one, the name
+         * uses the space of the object and argument fields. */
+        pxRecord->ullTask = ( uint64_t ) ( uintptr_t ) pvTask;
+        strncpy( pxRecord->u.acName, pcName, sizeof( pxRecord->u.acName ) );
+        pxRecord->usFlags = 0;
+        __atomic_store_n( &pxRecord->usEvent, ( uint16_t ) eEvent, __ATOMIC_RELEASE );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vTraceRecordTaskCreate( const void * pvTask,
+                             const char * pcName )
+{
+    prvTraceRecordName( eTraceTASK_CREATE, pvTask, pcName );
+}
+/*-----------------------------------------------------------*/
+
+void vTraceRecordTaskName( const void * pvTask,
+                           const char * pcName )
+{
+    prvTraceRecordName( eTraceTASK_NAME, pvTask, pcName );
+}
+/*-----------------------------------------------------------*/
+
+void vTraceRecordQueue( eTraceEvent eEvent,
+                        const void * pvQueue,
+                        uint8_t ucQueueType,
+                        uint32_t ulItemsWaiting,
+                        uint16_t usFlags )
+{
+    if( ucQueueType != queueQUEUE_TYPE_BASE )
+    {
+        /* Semaphores and mutexes are queues of zero sized items, sending
+         * is a give and receiving is a take. */
+        switch( eEvent )
+        {
+            case eTraceQUEUE_SEND:                eEvent = eTraceSEMAPHORE_GIVE; break;
+            case eTraceQUEUE_SEND_FAILED:         eEvent = eTraceSEMAPHORE_GIVE_FAILED; break;
+            case eTraceQUEUE_RECEIVE:             eEvent = eTraceSEMAPHORE_TAKE; break;
+            case eTraceQUEUE_RECEIVE_FAILED:      eEvent = eTraceSEMAPHORE_TAKE_FAILED; break;
+            case eTraceBLOCKING_ON_QUEUE_SEND:    eEvent = eTraceBLOCKING_ON_SEMAPHORE_GIVE; break;
+            case eTraceBLOCKING_ON_QUEUE_RECEIVE: eEvent = eTraceBLOCKING_ON_SEMAPHORE_TAKE; break;
+            default:                              break;
+        }
+    }
+
+    vTraceRecord( eEvent, pvQueue, ulItemsWaiting, usFlags );
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Map the ring file before main() runs, so that tasks created before the
+ * scheduler is started are recorded as well. If no file is configured or
+ * anything fails the recorder stays disabled and the application runs untraced.
+ */
+static void __attribute__( ( constructor ) ) prvTraceRecorderInit( void )
+{
+    char acPath[ 256 ];
+    const char * pcPath = getenv( "FREERTOS_TRACE_FILE" );
+    const size_t xSize = sizeof( TraceHeader_t ) + configPOSIX_TRACE_BUFFER_RECORDS * sizeof( TraceRecord_t );
+    TraceHeader_t * pxHeader;
+    void * pvMap;
+    int iFd;
+
+    if( ( pcPath == NULL ) || ( pcPath[ 0 ] == '\0' ) )
+    {
+        #ifdef configPOSIX_TRACE_FILE_PATTERN
+            snprintf( acPath, sizeof( acPath ), configPOSIX_TRACE_FILE_PATTERN, ( int ) getpid() );
+            pcPath = acPath;
+        #else
+            ( void ) acPath;
+            return;
+        #endif
+    }
+
+    iFd = open( pcPath, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+    if( iFd < 0 )
+    {
+        return;
+    }
+
+    if( ftruncate( iFd, ( off_t ) xSize ) != 0 )
+    {
+        close( iFd );
+        return;
+    }
+
+    pvMap = mmap( NULL, xSize, PROT_READ | PROT_WRITE, MAP_SHARED, iFd, 0 );
+    close( iFd );
+
+    if( pvMap == MAP_FAILED )
+    {
+        return;
+    }
+
+    pxHeader = ( TraceHeader_t * ) pvMap;
+    memcpy( pxHeader->acMagic, traceRECORDER_MAGIC, sizeof( pxHeader->acMagic ) );
+    pxHeader->ulVersion = traceRECORDER_VERSION;
+    pxHeader->ulRecordSize = sizeof( TraceRecord_t );
+    pxHeader->ullCapacity = configPOSIX_TRACE_BUFFER_RECORDS;
+    pxHeader->ullStartTime = prvTraceTimestamp();
+    pxHeader->ullWriteIndex = 0;
+    pxHeader->ulPid = ( uint32_t ) getpid();
+    pxHeader->ulTickRateHz = ( uint32_t ) configTICK_RATE_HZ;
+
+    pxTraceRecords = ( TraceRecord_t * ) ( pxHeader + 1 );
+    __atomic_store_n( &pxTraceHeader, pxHeader, __ATOMIC_RELEASE );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_POSIX_TRACE_RECORDER */
@@ -0,0 +1,197 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary trace recorder for the posix port.
+ *
+ * Enabled with configUSE_POSIX_TRACE_RECORDER == 1. Kernel events are
+ * written as fixed size records into a ring buffer that lives in a
+ * memory-mapped file, so the data survives a crash of the process and
+ * can be converted offline to the Chrome trace event format with
+ * tools/trace_export.cpp.
+ *
+ * The file consists of one TraceHeader_t followed by ullCapacity
+ * TraceRecord_t entries. ullWriteIndex counts all records ever written,
+ * the record for index i is stored at slot ( i % ullCapacity ). usEvent is
+ * cleared when a slot is claimed and stored last, 0 marks a record that
+ * is still being written.
+ *
+ * Recording neither allocates nor formats anything; a record costs one
+ * clock_gettime( CLOCK_MONOTONIC ) (vDSO) and one atomic increment.
+ *
+ * The file name is taken from the environment variable
+ * FREERTOS_TRACE_FILE. If it isn't set, configPOSIX_TRACE_FILE_PATTERN is
+ * used with the process id, but only if the project defines it. Without
+ * either the recorder stays disabled, so runs don't leave trace files
+ * behind that nobody asked for. An existing file is truncated and reused.
+ */
+
+#ifndef TRACE_RECORDER_H_
+#define TRACE_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifndef configPOSIX_TRACE_BUFFER_RECORDS
+    #define configPOSIX_TRACE_BUFFER_RECORDS    ( 65536UL )
+#endif
+
+#define traceRECORDER_MAGIC      "FRTTRACE"
+#define traceRECORDER_VERSION    ( 1UL )
+
+typedef enum
+{
+    eTraceTASK_CREATE = 1,       /* ullObject: task, acName: task name */
+    eTraceTASK_DELETE,           /* ullObject: task */
+    eTraceTASK_SWITCHED_IN,      /* ullObject: task, ulArg: priority */
+    eTraceQUEUE_SEND,            /* ullObject: queue, ulArg: items waiting before the operation */
+    eTraceQUEUE_SEND_FAILED,
+    eTraceQUEUE_RECEIVE,
+    eTraceQUEUE_RECEIVE_FAILED,
+    eTraceSEMAPHORE_GIVE,        /* ullObject: semaphore / mutex, ulArg: count before the operation */
+    eTraceSEMAPHORE_GIVE_FAILED,
+    eTraceSEMAPHORE_TAKE,
+    eTraceSEMAPHORE_TAKE_FAILED,
+    eTraceTIMER_EXPIRED,         /* ullObject: timer, callback is called next */
+    eTraceISR_ENTER,
+    eTraceISR_EXIT,
+    eTraceISR_EXIT_TO_SCHEDULER,
+    eTraceTASK_NAME,                   /* like eTraceTASK_CREATE, task was renamed */
+    eTraceTASK_READY,                  /* ullObject: task, ulArg: priority */
+    eTraceTASK_DELAY,                  /* ulArg: ticks to delay */
+    eTraceTASK_DELAY_UNTIL,            /* ulArg: tick to wake */
+    eTraceTASK_SUSPEND,                /* ullObject: task */
+    eTraceTASK_PRIORITY_INHERIT,       /* ullObject: mutex holder, ulArg: inherited priority */
+    eTraceTASK_PRIORITY_DISINHERIT,    /* ullObject: mutex holder, ulArg: restored priority */
+    eTraceBLOCKING_ON_QUEUE_SEND,      /* ullObject: queue, ulArg: items waiting */
+    eTraceBLOCKING_ON_QUEUE_RECEIVE,
+    eTraceBLOCKING_ON_QUEUE_PEEK,
+    eTraceBLOCKING_ON_SEMAPHORE_GIVE,  /* ullObject: semaphore / mutex, ulArg: count */
+    eTraceBLOCKING_ON_SEMAPHORE_TAKE,
+    eTraceBLOCKING_ON_NOTIFY,          /* ulArg: notification index */
+    eTraceBLOCKING_ON_EVENT_GROUP,     /* ullObject: event group, ulArg: bits to wait for */
+    eTraceBLOCKING_ON_STREAM_BUFFER    /* ullObject: stream buffer */
+} eTraceEvent;
+
+#define traceRECORD_FLAG_FROM_ISR    ( 0x0001U )
+
+typedef struct xTRACE_RECORD
+{
+    uint64_t ullTimestamp; /* CLOCK_MONOTONIC in ns */
+    uint64_t ullTask;      /* handle of the running task */
+    uint16_t usEvent;
+    uint16_t usFlags;
+    union
+    {
+        struct __attribute__( ( packed ) )
+        {
+            uint32_t ulArg;
+            uint64_t ullObject; /* offset 24, so still naturally aligned */
+        } xObject;
+        char acName[ 12 ]; /* eTraceTASK_CREATE only, not necessarily terminated */
+    } u;
+} TraceRecord_t;
+
+typedef struct xTRACE_HEADER
+{
+    char acMagic[ 8 ];
+    uint32_t ulVersion;
+    uint32_t ulRecordSize;
+    uint64_t ullCapacity;
+    uint64_t ullStartTime; /* CLOCK_MONOTONIC in ns when the recorder was started */
+    uint64_t ullWriteIndex;
+    uint32_t ulPid;
+    uint32_t ulTickRateHz;
+    uint8_t ucReserved[ 16 ];
+} TraceHeader_t;
+
+#ifndef __cplusplus
+    _Static_assert( sizeof( TraceRecord_t ) == 32, "unexpected trace record size" );
+    _Static_assert( sizeof( TraceHeader_t ) == 64, "unexpected trace header size" );
+#endif
+
+void vTraceRecord( eTraceEvent eEvent,
+                   const void * pvObject,
+                   uint32_t ulArg,
+                   uint16_t usFlags );
+void vTraceRecordTaskCreate( const void * pvTask,
+                             const char * pcName );
+void vTraceRecordTaskName( const void * pvTask,
+                           const char * pcName );
+void vTraceRecordQueue( eTraceEvent eEvent,
+                        const void * pvQueue,
+                        uint8_t ucQueueType,
+                        uint32_t ulItemsWaiting,
+                        uint16_t usFlags );
+
+/*
+ * Trace hooks, see FreeRTOS.h for the full list. Queue events on
+ * semaphores and mutexes are reported as semaphore events by
+ * vTraceRecordQueue() based on the queue type. Recursive mutexes end up
+ * in xQueueSemaphoreTake() / xQueueGenericSend() when they change hands,
+ * so they don't need hooks of their own.
+ */
+#define traceTASK_CREATE( pxNewTCB )                vTraceRecordTaskCreate( ( pxNewTCB ), ( pxNewTCB )->pcTaskName )
+#define traceTASK_DELETE( pxTCB )                   vTraceRecord( eTraceTASK_DELETE, ( pxTCB ), 0, 0 )
+#define traceTASK_SWITCHED_IN()                     vTraceRecord( eTraceTASK_SWITCHED_IN, pxCurrentTCB, ( uint32_t ) pxCurrentTCB->uxPriority, 0 )
+#define traceMOVED_TASK_TO_READY_STATE( pxTCB )     vTraceRecord( eTraceTASK_READY, ( pxTCB ), ( uint32_t ) ( pxTCB )->uxPriority, 0 )
+#define traceTASK_DELAY()                           vTraceRecord( eTraceTASK_DELAY, NULL, ( uint32_t ) xTicksToDelay, 0 )
+#define traceTASK_DELAY_UNTIL( xTimeToWake )        vTraceRecord( eTraceTASK_DELAY_UNTIL, NULL, ( uint32_t ) ( xTimeToWake ), 0 )
+#define traceTASK_SUSPEND( pxTaskToSuspend )        vTraceRecord( eTraceTASK_SUSPEND, ( pxTaskToSuspend ), 0, 0 )
+#define traceTASK_PRIORITY_INHERIT( pxTCBOfMutexHolder, uxInheritedPriority ) \
+    vTraceRecord( eTraceTASK_PRIORITY_INHERIT, ( pxTCBOfMutexHolder ), ( uint32_t ) ( uxInheritedPriority ), 0 )
+#define traceTASK_PRIORITY_DISINHERIT( pxTCBOfMutexHolder, uxOriginalPriority ) \
+    vTraceRecord( eTraceTASK_PRIORITY_DISINHERIT, ( pxTCBOfMutexHolder ), ( uint32_t ) ( uxOriginalPriority ), 0 )
+#define traceTASK_NOTIFY_TAKE_BLOCK( uxIndexToWait ) vTraceRecord( eTraceBLOCKING_ON_NOTIFY, NULL, ( uint32_t ) ( uxIndexToWait ), 0 )
+#define traceTASK_NOTIFY_WAIT_BLOCK( uxIndexToWait ) vTraceRecord( eTraceBLOCKING_ON_NOTIFY, NULL, ( uint32_t ) ( uxIndexToWait ), 0 )
+
+#define traceQUEUE_SEND( pxQueue )                  vTraceRecordQueue( eTraceQUEUE_SEND, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceQUEUE_SEND_FAILED( pxQueue )           vTraceRecordQueue( eTraceQUEUE_SEND_FAILED, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceQUEUE_SEND_FROM_ISR( pxQueue )         vTraceRecordQueue( eTraceQUEUE_SEND, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, traceRECORD_FLAG_FROM_ISR )
+#define traceQUEUE_SEND_FROM_ISR_FAILED( pxQueue )  vTraceRecordQueue( eTraceQUEUE_SEND_FAILED, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, traceRECORD_FLAG_FROM_ISR )
+#define traceQUEUE_RECEIVE( pxQueue )               vTraceRecordQueue( eTraceQUEUE_RECEIVE, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceQUEUE_RECEIVE_FAILED( pxQueue )        vTraceRecordQueue( eTraceQUEUE_RECEIVE_FAILED, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceQUEUE_RECEIVE_FROM_ISR( pxQueue )      vTraceRecordQueue( eTraceQUEUE_RECEIVE, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, traceRECORD_FLAG_FROM_ISR )
+#define traceQUEUE_RECEIVE_FROM_ISR_FAILED( pxQueue ) \
+    vTraceRecordQueue( eTraceQUEUE_RECEIVE_FAILED, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, traceRECORD_FLAG_FROM_ISR )
+#define traceBLOCKING_ON_QUEUE_SEND( pxQueue )      vTraceRecordQueue( eTraceBLOCKING_ON_QUEUE_SEND, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceBLOCKING_ON_QUEUE_RECEIVE( pxQueue )   vTraceRecordQueue( eTraceBLOCKING_ON_QUEUE_RECEIVE, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+#define traceBLOCKING_ON_QUEUE_PEEK( pxQueue )      vTraceRecordQueue( eTraceBLOCKING_ON_QUEUE_PEEK, ( pxQueue ), ( pxQueue )->ucQueueType, ( uint32_t ) ( pxQueue )->uxMessagesWaiting, 0 )
+
+#define traceEVENT_GROUP_SYNC_BLOCK( xEventGroup, uxBitsToSet, uxBitsToWaitFor ) \
+    vTraceRecord( eTraceBLOCKING_ON_EVENT_GROUP, ( xEventGroup ), ( uint32_t ) ( uxBitsToWaitFor ), 0 )
+#define traceEVENT_GROUP_WAIT_BITS_BLOCK( xEventGroup, uxBitsToWaitFor ) \
+    vTraceRecord( eTraceBLOCKING_ON_EVENT_GROUP, ( xEventGroup ), ( uint32_t ) ( uxBitsToWaitFor ), 0 )
+#define traceBLOCKING_ON_STREAM_BUFFER_SEND( xStreamBuffer )    vTraceRecord( eTraceBLOCKING_ON_STREAM_BUFFER, ( xStreamBuffer ), 0, 0 )
+#define traceBLOCKING_ON_STREAM_BUFFER_RECEIVE( xStreamBuffer ) vTraceRecord( eTraceBLOCKING_ON_STREAM_BUFFER, ( xStreamBuffer ), 0, 0 )
+
+#define traceTIMER_EXPIRED( pxTimer )               vTraceRecord( eTraceTIMER_EXPIRED, ( pxTimer ), 0, 0 )
+
+#define traceISR_ENTER()                            vTraceRecord( eTraceISR_ENTER, NULL, 0, traceRECORD_FLAG_FROM_ISR )
+#define traceISR_EXIT()                             vTraceRecord( eTraceISR_EXIT, NULL, 0, traceRECORD_FLAG_FROM_ISR )
+#define traceISR_EXIT_TO_SCHEDULER()                vTraceRecord( eTraceISR_EXIT_TO_SCHEDULER, NULL, 0, traceRECORD_FLAG_FROM_ISR )
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* ifndef TRACE_RECORDER_H_ */
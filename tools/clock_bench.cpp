@@ -0,0 +1,106 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    clock_bench.cpp
+ * @brief   Compare the cost of the time sources behind freertos::get_us() on the host
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ *
+ * Build on the host: g++ -std=c++17 -O2 -o clock_bench clock_bench.cpp
+ * Usage: clock_bench [<calls>]
+ *
+ * Measures the time per call and counts steps backwards for the former floating point conversion, the integer
+ * conversion of ullPortGetTimeNs() on CLOCK_MONOTONIC and CLOCK_MONOTONIC_COARSE (configPOSIX_TIME_CLOCK) and the
+ * scaled conversion used after vPortSetTickPeriodUs(). The conversions are copies of the ones in the port, so the
+ * tool builds without FreeRTOS.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+
+namespace {
+uint64_t clock_ns(clockid_t clock) {
+    timespec t;
+    ::clock_gettime(clock, &t);
+    return static_cast<uint64_t>(t.tv_sec) * 1'000'000'000ULL + static_cast<uint64_t>(t.tv_nsec);
+}
+
+uint64_t us_float() {
+    timespec t;
+    ::clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<uint64_t>(t.tv_sec) * 1'000'000ULL + static_cast<uint64_t>(std::round(t.tv_nsec / 1.0e3));
+}
+
+uint64_t us_monotonic() {
+    return clock_ns(CLOCK_MONOTONIC) / 1'000ULL;
+}
+
+uint64_t us_coarse() {
+    return clock_ns(CLOCK_MONOTONIC_COARSE) / 1'000ULL;
+}
+
+volatile uint64_t sink; // keeps the calls from being optimized away
+volatile uint32_t period_us { 250 }; // tick period set at run time, 1 ms ticks run four times faster
+
+uint64_t us_scaled() {
+    const uint64_t period_ns { period_us * 1'000ULL };
+    const uint64_t tick_ns { 1'000'000ULL };
+    const uint64_t elapsed_ns { clock_ns(CLOCK_MONOTONIC) };
+
+    return ((elapsed_ns / period_ns) * tick_ns + (elapsed_ns % period_ns) * tick_ns / period_ns) / 1'000ULL;
+}
+
+void run(const char* name, uint64_t (*fn)(), unsigned long calls) {
+    unsigned long backwards {};
+    uint64_t sum {};
+    uint64_t last { fn() };
+
+    const auto start { clock_ns(CLOCK_MONOTONIC) };
+    for (unsigned long i {}; i < calls; ++i) {
+        const auto now { fn() };
+        backwards += now < last;
+        sum += now;
+        last = now;
+    }
+    const auto end { clock_ns(CLOCK_MONOTONIC) };
+
+    sink = sum;
+
+    std::printf("%-28s %7.1f ns/call  %lu steps backwards\n", name, static_cast<double>(end - start) / calls, backwards);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    const unsigned long calls { argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10'000'000UL };
+
+    timespec res;
+    ::clock_getres(CLOCK_MONOTONIC_COARSE, &res);
+    std::printf("%lu calls each, CLOCK_MONOTONIC_COARSE resolution %ld us\n\n", calls, res.tv_nsec / 1'000L);
+
+    run("round(tv_nsec / 1e3)", us_float, calls);
+    run("CLOCK_MONOTONIC", us_monotonic, calls);
+    run("CLOCK_MONOTONIC_COARSE", us_coarse, calls);
+    run("CLOCK_MONOTONIC, scaled", us_scaled, calls);
+
+    return 0;
+}
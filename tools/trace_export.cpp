@@ -0,0 +1,336 @@
+/*
+ * This file is part of the FreeRTOS port for posix plattform.
+ * Copyright (c) 2020 Timo Sandmann
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file    trace_export.cpp
+ * @brief   Convert a trace file of the posix trace recorder to the Chrome trace event format
+ * @author  Timo Sandmann
+ * @date    18.10.2026
+ *
+ * Build on the host: g++ -std=c++17 -O2 -I../src/portable/utils -o trace_export trace_export.cpp
+ * Usage: trace_export <trace.bin> [<trace.json>]
+ *
+ * The result can be opened with chrome://tracing or https://ui.perfetto.dev. Every FreeRTOS task gets
+ * its own track showing when it was running, ready or blocked (including the reason it blocked), the
+ * "CPU" track shows which task owned the simulated CPU. Timestamps are CLOCK_MONOTONIC, so the trace
+ * lines up with host traces recorded with the same clock (e.g. perf record -k CLOCK_MONOTONIC).
+ */
+
+#include "trace_recorder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+
+namespace {
+constexpr uint32_t CPU_TID { 0 };
+constexpr uint32_t ISR_TID { 1'000'000 };
+
+struct task_state {
+    uint32_t tid;
+    std::string name;
+    const char* state; // current slice on the task track, nullptr if none is open
+    std::string block_reason;
+};
+
+class exporter {
+    FILE* out_;
+    uint32_t pid_;
+    bool first_ { true };
+    std::unordered_map<uint64_t, task_state> tasks_;
+    uint32_t next_tid_ { 1 };
+    uint64_t running_ {};
+    uint32_t isr_nesting_ {};
+
+    static std::string escape(const std::string& str) {
+        std::string res;
+        for (const char c : str) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                res += buf;
+            } else {
+                res += c;
+            }
+        }
+        return res;
+    }
+
+    static std::string hex(const uint64_t value) {
+        char buf[24];
+        std::snprintf(buf, sizeof(buf), "0x%" PRIx64, value);
+        return buf;
+    }
+
+    void emit(const char* ph, const std::string& name, const uint32_t tid, const uint64_t ts, const std::string& args = {}) {
+        std::fprintf(out_, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%" PRIu64 ".%03u", first_ ? "" : ",", ph, escape(name).c_str(), pid_,
+            tid, ts / 1'000, static_cast<unsigned>(ts % 1'000));
+        if (ph[0] == 'i') {
+            std::fputs(",\"s\":\"t\"", out_);
+        }
+        if (!args.empty()) {
+            std::fprintf(out_, ",\"args\":{%s}", args.c_str());
+        }
+        std::fputc('}', out_);
+        first_ = false;
+    }
+
+    task_state& task(const uint64_t handle) {
+        auto it { tasks_.find(handle) };
+        if (it == tasks_.end()) { // creation record was overwritten in the ring
+            it = tasks_.emplace(handle, task_state { next_tid_++, "task " + hex(handle), nullptr, {} }).first;
+        }
+        return it->second;
+    }
+
+    void set_state(task_state& t, const char* state, const uint64_t ts) {
+        if (t.state) {
+            emit("E", t.state, t.tid, ts);
+        }
+        t.state = state;
+        if (state) {
+            if (std::strcmp(state, "Blocked") == 0 && !t.block_reason.empty()) {
+                emit("B", state, t.tid, ts, "\"reason\":\"" + escape(t.block_reason) + "\"");
+            } else {
+                emit("B", state, t.tid, ts);
+            }
+        }
+    }
+
+    void block(const uint64_t ts, const uint64_t handle, std::string reason) {
+        if (!handle) {
+            return;
+        }
+        auto& t { task(handle) };
+        emit("i", "block: " + reason, t.tid, ts);
+        t.block_reason = std::move(reason);
+    }
+
+    static const char* queue_op(const uint16_t ev) {
+        switch (ev) {
+            case eTraceQUEUE_SEND: return "xQueueSend";
+            case eTraceQUEUE_SEND_FAILED: return "xQueueSend (failed)";
+            case eTraceQUEUE_RECEIVE: return "xQueueReceive";
+            case eTraceQUEUE_RECEIVE_FAILED: return "xQueueReceive (failed)";
+            case eTraceSEMAPHORE_GIVE: return "xSemaphoreGive";
+            case eTraceSEMAPHORE_GIVE_FAILED: return "xSemaphoreGive (failed)";
+            case eTraceSEMAPHORE_TAKE: return "xSemaphoreTake";
+            case eTraceSEMAPHORE_TAKE_FAILED: return "xSemaphoreTake (failed)";
+            default: return nullptr;
+        }
+    }
+
+public:
+    exporter(FILE* out, const uint32_t pid) : out_ { out }, pid_ { pid } {
+        std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out_);
+    }
+
+    void process(const TraceRecord_t& r) {
+        const uint64_t ts { r.ullTimestamp };
+        const uint64_t obj { r.u.xObject.ullObject };
+        const uint32_t arg { r.u.xObject.ulArg };
+        const bool from_isr { (r.usFlags & traceRECORD_FLAG_FROM_ISR) != 0 };
+        const uint32_t tid { from_isr ? ISR_TID : (r.ullTask ? task(r.ullTask).tid : CPU_TID) };
+
+        switch (r.usEvent) {
+            case eTraceTASK_CREATE:
+            case eTraceTASK_NAME: {
+                char name[sizeof(r.u.acName) + 1] {};
+                std::memcpy(name, r.u.acName, sizeof(r.u.acName));
+                auto& t { task(r.ullTask) };
+                t.name = name;
+                if (r.usEvent == eTraceTASK_CREATE) {
+                    set_state(t, "Ready", ts);
+                }
+                break;
+            }
+
+            case eTraceTASK_DELETE: {
+                auto& t { task(obj) };
+                set_state(t, nullptr, ts);
+                emit("i", "deleted", t.tid, ts);
+                break;
+            }
+
+            case eTraceTASK_SWITCHED_IN: {
+                if (running_ == obj) {
+                    break;
+                }
+                if (running_) {
+                    auto& prev { task(running_) };
+                    emit("E", prev.name, CPU_TID, ts);
+                    set_state(prev, prev.block_reason.empty() ? "Ready" : "Blocked", ts);
+                }
+                auto& t { task(obj) };
+                t.block_reason.clear();
+                set_state(t, "Running", ts);
+                emit("B", t.name, CPU_TID, ts, "\"priority\":" + std::to_string(arg));
+                running_ = obj;
+                break;
+            }
+
+            case eTraceTASK_READY: {
+                auto& t { task(obj) };
+                t.block_reason.clear();
+                if (obj != running_ && t.state && std::strcmp(t.state, "Ready") != 0) {
+                    set_state(t, "Ready", ts);
+                }
+                break;
+            }
+
+            case eTraceTASK_DELAY: block(ts, r.ullTask, "vTaskDelay(" + std::to_string(arg) + " ticks)"); break;
+            case eTraceTASK_DELAY_UNTIL: block(ts, r.ullTask, "delay until tick " + std::to_string(arg)); break;
+            case eTraceTASK_SUSPEND: block(ts, obj ? obj : r.ullTask, "suspended"); break;
+            case eTraceBLOCKING_ON_QUEUE_SEND: block(ts, r.ullTask, "queue full " + hex(obj)); break;
+            case eTraceBLOCKING_ON_QUEUE_RECEIVE: block(ts, r.ullTask, "queue empty " + hex(obj)); break;
+            case eTraceBLOCKING_ON_QUEUE_PEEK: block(ts, r.ullTask, "queue peek " + hex(obj)); break;
+            case eTraceBLOCKING_ON_SEMAPHORE_GIVE: block(ts, r.ullTask, "semaphore give " + hex(obj)); break;
+            case eTraceBLOCKING_ON_SEMAPHORE_TAKE: block(ts, r.ullTask, "semaphore / mutex take " + hex(obj)); break;
+            case eTraceBLOCKING_ON_NOTIFY: block(ts, r.ullTask, "task notification [" + std::to_string(arg) + "]"); break;
+            case eTraceBLOCKING_ON_EVENT_GROUP: block(ts, r.ullTask, "event group " + hex(obj) + " bits " + hex(arg)); break;
+            case eTraceBLOCKING_ON_STREAM_BUFFER: block(ts, r.ullTask, "stream buffer " + hex(obj)); break;
+
+            case eTraceTASK_PRIORITY_INHERIT:
+            case eTraceTASK_PRIORITY_DISINHERIT: {
+                const bool inherit { r.usEvent == eTraceTASK_PRIORITY_INHERIT };
+                auto& holder { task(obj) };
+                emit("i", inherit ? "priority inherit" : "priority disinherit", holder.tid, ts,
+                    "\"priority\":" + std::to_string(arg) + ",\"by\":\"" + escape(r.ullTask ? task(r.ullTask).name : std::string {}) + "\"");
+                break;
+            }
+
+            case eTraceQUEUE_SEND:
+            case eTraceQUEUE_SEND_FAILED:
+            case eTraceQUEUE_RECEIVE:
+            case eTraceQUEUE_RECEIVE_FAILED:
+            case eTraceSEMAPHORE_GIVE:
+            case eTraceSEMAPHORE_GIVE_FAILED:
+            case eTraceSEMAPHORE_TAKE:
+            case eTraceSEMAPHORE_TAKE_FAILED: {
+                emit("i", queue_op(r.usEvent), tid, ts, "\"object\":\"" + hex(obj) + "\",\"items\":" + std::to_string(arg));
+                if (r.usEvent == eTraceQUEUE_SEND || r.usEvent == eTraceQUEUE_RECEIVE) {
+                    const uint32_t items { r.usEvent == eTraceQUEUE_SEND ? arg + 1 : (arg ? arg - 1 : 0) };
+                    emit("C", "queue " + hex(obj), CPU_TID, ts, "\"items\":" + std::to_string(items));
+                }
+                break;
+            }
+
+            case eTraceTIMER_EXPIRED: emit("i", "timer " + hex(obj) + " expired", tid, ts); break;
+
+            case eTraceISR_ENTER:
+                ++isr_nesting_;
+                emit("B", "ISR", ISR_TID, ts);
+                break;
+
+            case eTraceISR_EXIT:
+            case eTraceISR_EXIT_TO_SCHEDULER:
+                if (isr_nesting_) {
+                    --isr_nesting_;
+                    emit("E", "ISR", ISR_TID, ts, r.usEvent == eTraceISR_EXIT_TO_SCHEDULER ? "\"switch\":true" : "");
+                }
+                break;
+
+            default: break;
+        }
+    }
+
+    void finish(const uint64_t ts, const uint64_t lost) {
+        for (auto& [handle, t] : tasks_) {
+            set_state(t, nullptr, ts);
+        }
+        if (running_) {
+            emit("E", task(running_).name, CPU_TID, ts);
+        }
+        for (const auto& [handle, t] : tasks_) {
+            emit("M", "thread_name", t.tid, 0, "\"name\":\"" + escape(t.name) + "\"");
+            emit("M", "thread_sort_index", t.tid, 0, "\"sort_index\":" + std::to_string(t.tid));
+        }
+        emit("M", "thread_name", CPU_TID, 0, "\"name\":\"CPU\"");
+        emit("M", "thread_name", ISR_TID, 0, "\"name\":\"ISR\"");
+        emit("M", "process_name", 0, 0, "\"name\":\"FreeRTOS\"");
+        std::fprintf(out_, "\n],\"otherData\":{\"lost_records\":%" PRIu64 "}}\n", lost);
+    }
+};
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <trace.bin> [<trace.json>]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in { std::fopen(argv[1], "rb") };
+    if (!in) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    TraceHeader_t header;
+    if (std::fread(&header, sizeof(header), 1, in) != 1 || std::memcmp(header.acMagic, traceRECORDER_MAGIC, sizeof(header.acMagic)) != 0
+        || header.ulRecordSize != sizeof(TraceRecord_t) || header.ullCapacity == 0) {
+        std::fprintf(stderr, "%s: not a trace recorder file\n", argv[1]);
+        std::fclose(in);
+        return 1;
+    }
+
+    std::vector<TraceRecord_t> ring(header.ullCapacity);
+    const size_t n { std::fread(ring.data(), sizeof(TraceRecord_t), ring.size(), in) };
+    std::fclose(in);
+
+    const uint64_t written { header.ullWriteIndex };
+    const uint64_t count { std::min<uint64_t>({ written, header.ullCapacity, n }) };
+    const uint64_t first { written - count };
+    std::vector<TraceRecord_t> records;
+    records.reserve(count);
+    for (uint64_t i { first }; i < written; ++i) {
+        const auto& r { ring[i % header.ullCapacity] };
+        if (r.usEvent) { // 0: the slot was claimed but the record not completed, e.g. on a crash
+            records.push_back(r);
+        }
+    }
+    // slots are claimed before the timestamp is taken, so a record may be slightly out of order
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord_t& a, const TraceRecord_t& b) { return a.ullTimestamp < b.ullTimestamp; });
+
+    FILE* out { argc > 2 ? std::fopen(argv[2], "w") : stdout };
+    if (!out) {
+        std::perror(argv[2]);
+        return 1;
+    }
+
+    exporter exp { out, header.ulPid };
+    for (const auto& r : records) {
+        exp.process(r);
+    }
+    exp.finish(records.empty() ? header.ullStartTime : records.back().ullTimestamp, first);
+
+    if (first) {
+        std::fprintf(stderr, "warning: ring buffer wrapped, %" PRIu64 " oldest records lost\n", first);
+    }
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}